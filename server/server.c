@@ -0,0 +1,743 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Stand in for an application running under rbug.
+ *
+ * Serves a configurable set of made up contexts, textures and shaders
+ * so rbug-gui can be exercised without a live application or GPU.
+ * Contexts draw at a fixed interval, changing the content of every
+ * texture, and block when asked to just like the real thing.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include <glib.h>
+
+#include "pipe/p_format.h"
+#include "rbug/rbug.h"
+#include "tgsi/tgsi_parse.h"
+#include "tgsi/tgsi_text.h"
+#include "util/u_format.h"
+#include "util/u_network.h"
+
+#define SERVER_CONTEXT_BASE 0x40000000
+#define SERVER_SHADER_BASE  0x80000000
+
+#define SERVER_MAX_TOKENS 1024
+#define SERVER_MAX_LEVELS 16
+#define SERVER_MAX_TEXS 16
+
+struct server_texture
+{
+	rbug_texture_t id;
+	enum pipe_format format;
+	unsigned width;
+	unsigned height;
+	unsigned last_level;
+};
+
+struct server_shader
+{
+	rbug_shader_t id;
+	gboolean fragment;
+	gboolean disabled;
+
+	uint32_t *replaced;
+	uint32_t replaced_len;
+};
+
+struct server_context
+{
+	rbug_context_t id;
+	rbug_block_t blocker;
+	rbug_block_t blocked;
+
+	/* next draw, g_get_monotonic_time */
+	gint64 next;
+};
+
+struct server
+{
+	int port;
+	int num_contexts;
+	int num_textures;
+	int num_shaders;
+	int interval;
+	char *formats;
+	char *sizes;
+
+	struct server_texture *textures;
+	struct server_context *contexts;
+	struct server_shader *shaders;
+
+	struct tgsi_token vert[SERVER_MAX_TOKENS];
+	struct tgsi_token frag[SERVER_MAX_TOKENS];
+
+	/* bumped every draw, textures change with it */
+	unsigned frame;
+
+	struct rbug_connection *con;
+};
+
+static const char *server_vert_text =
+	"VERT\n"
+	"DCL IN[0]\n"
+	"DCL OUT[0], POSITION\n"
+	"  0: MOV OUT[0], IN[0]\n"
+	"  1: END\n";
+
+static const char *server_frag_text =
+	"FRAG\n"
+	"DCL IN[0], COLOR, LINEAR\n"
+	"DCL OUT[0], COLOR\n"
+	"  0: MOV OUT[0], IN[0]\n"
+	"  1: END\n";
+
+
+/*
+ * Setup
+ */
+
+
+static enum pipe_format server_parse_format(const char *name)
+{
+	unsigned f;
+
+	for (f = 1; f < PIPE_FORMAT_COUNT; f++) {
+		if (!util_format_description(f))
+			continue;
+
+		if (!strcmp(name, util_format_name(f)) ||
+		    !strcmp(name, util_format_short_name(f)))
+			return f;
+	}
+
+	return PIPE_FORMAT_NONE;
+}
+
+static gboolean server_setup_textures(struct server *s)
+{
+	gchar **formats = g_strsplit(s->formats, ",", 0);
+	gchar **sizes = g_strsplit(s->sizes, ",", 0);
+	struct server_texture *t;
+	unsigned nf = g_strv_length(formats);
+	unsigned ns = g_strv_length(sizes);
+	unsigned w, h, i;
+	gboolean ret = FALSE;
+
+	if (!nf || !ns)
+		goto out;
+
+	s->textures = g_malloc0(sizeof(*s->textures) * MAX(s->num_textures, 1));
+
+	for (i = 0; i < (unsigned)s->num_textures; i++) {
+		t = &s->textures[i];
+		t->id = i + 1;
+
+		t->format = server_parse_format(formats[i % nf]);
+		if (t->format == PIPE_FORMAT_NONE) {
+			g_printerr("unknown format %s\n", formats[i % nf]);
+			goto out;
+		}
+
+		if (sscanf(sizes[i % ns], "%ux%u", &w, &h) != 2 || !w || !h) {
+			g_printerr("bad size %s, should be WxH\n", sizes[i % ns]);
+			goto out;
+		}
+
+		t->width = w;
+		t->height = h;
+		t->last_level = MIN(g_bit_storage(MAX(w, h)) - 1, SERVER_MAX_LEVELS - 1);
+	}
+
+	ret = TRUE;
+
+out:
+	g_strfreev(formats);
+	g_strfreev(sizes);
+
+	return ret;
+}
+
+static gboolean server_setup(struct server *s)
+{
+	int i;
+
+	if (!tgsi_text_translate(server_vert_text, s->vert, SERVER_MAX_TOKENS) ||
+	    !tgsi_text_translate(server_frag_text, s->frag, SERVER_MAX_TOKENS)) {
+		g_printerr("failed to build shaders\n");
+		return FALSE;
+	}
+
+	if (!server_setup_textures(s))
+		return FALSE;
+
+	s->contexts = g_malloc0(sizeof(*s->contexts) * MAX(s->num_contexts, 1));
+	for (i = 0; i < s->num_contexts; i++)
+		s->contexts[i].id = SERVER_CONTEXT_BASE + i;
+
+	s->shaders = g_malloc0(sizeof(*s->shaders) * MAX(s->num_contexts * s->num_shaders, 1));
+	for (i = 0; i < s->num_contexts * s->num_shaders; i++) {
+		s->shaders[i].id = SERVER_SHADER_BASE + i;
+		s->shaders[i].fragment = !(i % s->num_shaders % 2);
+	}
+
+	return TRUE;
+}
+
+
+/*
+ * Lookup
+ */
+
+
+static struct server_texture * server_texture(rbug_texture_t id, struct server *s)
+{
+	if (id < 1 || id > (rbug_texture_t)s->num_textures)
+		return NULL;
+
+	return &s->textures[id - 1];
+}
+
+static struct server_context * server_context(rbug_context_t id, struct server *s)
+{
+	if (id < SERVER_CONTEXT_BASE || id - SERVER_CONTEXT_BASE >= (rbug_context_t)s->num_contexts)
+		return NULL;
+
+	return &s->contexts[id - SERVER_CONTEXT_BASE];
+}
+
+static struct server_shader * server_shader(rbug_context_t ctx, rbug_shader_t id, struct server *s)
+{
+	struct server_context *c = server_context(ctx, s);
+	unsigned first;
+
+	if (!c || id < SERVER_SHADER_BASE)
+		return NULL;
+
+	/* shaders must belong to the context */
+	first = (c - s->contexts) * s->num_shaders;
+	if (id - SERVER_SHADER_BASE < first ||
+	    id - SERVER_SHADER_BASE >= first + s->num_shaders)
+		return NULL;
+
+	return &s->shaders[id - SERVER_SHADER_BASE];
+}
+
+
+/*
+ * Requests
+ */
+
+
+static void server_texture_list(uint32_t serial, struct server *s)
+{
+	rbug_texture_t *ids = g_malloc(sizeof(*ids) * MAX(s->num_textures, 1));
+	int i;
+
+	for (i = 0; i < s->num_textures; i++)
+		ids[i] = s->textures[i].id;
+
+	rbug_send_texture_list_reply(s->con, serial, ids, s->num_textures, NULL);
+
+	g_free(ids);
+}
+
+static void server_texture_info(struct rbug_proto_texture_info *info, uint32_t serial,
+                                struct server *s)
+{
+	struct server_texture *t = server_texture(info->texture, s);
+	const struct util_format_description *desc;
+	uint32_t width[SERVER_MAX_LEVELS];
+	uint32_t height[SERVER_MAX_LEVELS];
+	uint32_t depth[SERVER_MAX_LEVELS];
+	unsigned i;
+
+	if (!t) {
+		rbug_send_error_reply(s->con, serial, 0, NULL);
+		return;
+	}
+
+	desc = util_format_description(t->format);
+
+	for (i = 0; i <= t->last_level; i++) {
+		width[i] = MAX(t->width >> i, 1);
+		height[i] = MAX(t->height >> i, 1);
+		depth[i] = 1;
+	}
+
+	rbug_send_texture_info_reply(s->con, serial,
+	                             PIPE_TEXTURE_2D, t->format,
+	                             width, t->last_level + 1,
+	                             height, t->last_level + 1,
+	                             depth, t->last_level + 1,
+	                             desc->block.width, desc->block.height,
+	                             desc->block.bits / 8,
+	                             t->last_level, 1, 0,
+	                             NULL);
+}
+
+static void server_texture_read(struct rbug_proto_texture_read *read, uint32_t serial,
+                                struct server *s)
+{
+	struct server_texture *t = server_texture(read->texture, s);
+	const struct util_format_description *desc;
+	unsigned width, height, x, y, w, h;
+	unsigned nbx, nby, bx, by, blocksize;
+	unsigned stride, i, j;
+	uint8_t *data, *row;
+
+	if (!t || read->level > t->last_level) {
+		rbug_send_error_reply(s->con, serial, 0, NULL);
+		return;
+	}
+
+	desc = util_format_description(t->format);
+	blocksize = desc->block.bits / 8;
+
+	width = MAX(t->width >> read->level, 1);
+	height = MAX(t->height >> read->level, 1);
+
+	/* clip the box to the level */
+	x = MIN(read->x, width);
+	y = MIN(read->y, height);
+	w = MIN(read->w, width - x);
+	h = MIN(read->h, height - y);
+
+	nbx = util_format_get_nblocksx(t->format, w);
+	nby = util_format_get_nblocksy(t->format, h);
+	bx = x / desc->block.width;
+	by = y / desc->block.height;
+	stride = nbx * blocksize;
+
+	data = g_malloc(MAX((size_t)stride * nby, 1));
+
+	/* diagonal bands that move every frame */
+	for (j = 0; j < nby; j++) {
+		row = data + (size_t)stride * j;
+		for (i = 0; i < stride; i++)
+			row[i] = (uint8_t)((bx * blocksize + i) / blocksize + by + j + s->frame + t->id * 8);
+	}
+
+	rbug_send_texture_read_reply(s->con, serial, t->format,
+	                             desc->block.width, desc->block.height, blocksize,
+	                             data, stride * nby, stride,
+	                             NULL);
+
+	g_free(data);
+}
+
+static void server_context_list(uint32_t serial, struct server *s)
+{
+	rbug_context_t *ids = g_malloc(sizeof(*ids) * MAX(s->num_contexts, 1));
+	int i;
+
+	for (i = 0; i < s->num_contexts; i++)
+		ids[i] = s->contexts[i].id;
+
+	rbug_send_context_list_reply(s->con, serial, ids, s->num_contexts, NULL);
+
+	g_free(ids);
+}
+
+static void server_context_info(struct rbug_proto_context_info *info, uint32_t serial,
+                                struct server *s)
+{
+	struct server_context *c = server_context(info->context, s);
+	rbug_texture_t texs[SERVER_MAX_TEXS];
+	rbug_texture_t cbuf = 0;
+	rbug_shader_t vertex = 0, fragment = 0;
+	unsigned first, num_texs, i;
+
+	if (!c) {
+		rbug_send_error_reply(s->con, serial, 0, NULL);
+		return;
+	}
+
+	first = (c - s->contexts) * s->num_shaders;
+	for (i = 0; i < (unsigned)s->num_shaders; i++) {
+		if (s->shaders[first + i].fragment && !fragment)
+			fragment = s->shaders[first + i].id;
+		if (!s->shaders[first + i].fragment && !vertex)
+			vertex = s->shaders[first + i].id;
+	}
+
+	/* render to one texture and sample from the following ones */
+	num_texs = MIN(SERVER_MAX_TEXS, MAX(s->num_textures - 1, 0));
+	if (s->num_textures)
+		cbuf = s->textures[(c - s->contexts) % s->num_textures].id;
+	for (i = 0; i < num_texs; i++)
+		texs[i] = s->textures[(cbuf + i) % s->num_textures].id;
+
+	rbug_send_context_info_reply(s->con, serial,
+	                             vertex, 0, fragment,
+	                             texs, num_texs,
+	                             &cbuf, cbuf ? 1 : 0,
+	                             0,
+	                             c->blocker, c->blocked,
+	                             NULL);
+}
+
+static void server_shader_list(struct rbug_proto_shader_list *list, uint32_t serial,
+                               struct server *s)
+{
+	struct server_context *c = server_context(list->context, s);
+	rbug_shader_t *ids;
+	unsigned first;
+	int i;
+
+	if (!c) {
+		rbug_send_error_reply(s->con, serial, 0, NULL);
+		return;
+	}
+
+	ids = g_malloc(sizeof(*ids) * MAX(s->num_shaders, 1));
+	first = (c - s->contexts) * s->num_shaders;
+	for (i = 0; i < s->num_shaders; i++)
+		ids[i] = s->shaders[first + i].id;
+
+	rbug_send_shader_list_reply(s->con, serial, ids, s->num_shaders, NULL);
+
+	g_free(ids);
+}
+
+static void server_shader_info(struct rbug_proto_shader_info *info, uint32_t serial,
+                               struct server *s)
+{
+	struct server_shader *sh = server_shader(info->context, info->shader, s);
+	struct tgsi_token *tokens;
+
+	if (!sh) {
+		rbug_send_error_reply(s->con, serial, 0, NULL);
+		return;
+	}
+
+	tokens = sh->fragment ? s->frag : s->vert;
+
+	rbug_send_shader_info_reply(s->con, serial,
+	                            (uint32_t *)tokens, tgsi_num_tokens(tokens),
+	                            sh->replaced, sh->replaced_len,
+	                            sh->disabled,
+	                            NULL);
+}
+
+static void server_shader_disable(struct rbug_proto_shader_disable *disable,
+                                  struct server *s)
+{
+	struct server_shader *sh = server_shader(disable->context, disable->shader, s);
+
+	if (sh)
+		sh->disabled = disable->disable;
+}
+
+static void server_shader_replace(struct rbug_proto_shader_replace *replace,
+                                  struct server *s)
+{
+	struct server_shader *sh = server_shader(replace->context, replace->shader, s);
+
+	if (!sh)
+		return;
+
+	g_free(sh->replaced);
+	sh->replaced = NULL;
+	sh->replaced_len = replace->tokens_len;
+
+	if (replace->tokens_len) {
+		sh->replaced = g_malloc(sizeof(uint32_t) * replace->tokens_len);
+		memcpy(sh->replaced, replace->tokens, sizeof(uint32_t) * replace->tokens_len);
+	}
+}
+
+/**
+ * Draw with context c, blocking before and after if asked to.
+ */
+static void server_draw(struct server_context *c, gint64 now, struct server *s)
+{
+	if (c->blocker & RBUG_BLOCK_BEFORE) {
+		c->blocked = RBUG_BLOCK_BEFORE;
+		rbug_send_context_draw_blocked(s->con, c->id, c->blocked, NULL);
+		return;
+	}
+
+	s->frame++;
+	c->next = now + s->interval * 1000;
+
+	if (c->blocker & RBUG_BLOCK_AFTER) {
+		c->blocked = RBUG_BLOCK_AFTER;
+		rbug_send_context_draw_blocked(s->con, c->id, c->blocked, NULL);
+	}
+}
+
+static void server_context_step(struct server_context *c, rbug_block_t step,
+                                struct server *s)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (!(c->blocked & step))
+		return;
+
+	/* stepping past before does the draw, after that it's the next one */
+	if (c->blocked & RBUG_BLOCK_BEFORE) {
+		c->blocked = 0;
+		s->frame++;
+		c->next = now + s->interval * 1000;
+
+		if (c->blocker & RBUG_BLOCK_AFTER) {
+			c->blocked = RBUG_BLOCK_AFTER;
+			rbug_send_context_draw_blocked(s->con, c->id, c->blocked, NULL);
+		}
+	} else {
+		c->blocked = 0;
+		c->next = now;
+	}
+}
+
+static gboolean server_handle(struct rbug_header *header, uint32_t serial, struct server *s)
+{
+	struct rbug_proto_context_draw_block *block;
+	struct rbug_proto_context_draw_step *step;
+	struct rbug_proto_context_draw_unblock *unblock;
+	struct server_context *c;
+
+	switch ((int)header->opcode) {
+	case RBUG_OP_NOOP:
+		break;
+	case RBUG_OP_PING:
+		rbug_send_ping_reply(s->con, serial, NULL);
+		break;
+	case RBUG_OP_TEXTURE_LIST:
+		server_texture_list(serial, s);
+		break;
+	case RBUG_OP_TEXTURE_INFO:
+		server_texture_info((struct rbug_proto_texture_info *)header, serial, s);
+		break;
+	case RBUG_OP_TEXTURE_READ:
+		server_texture_read((struct rbug_proto_texture_read *)header, serial, s);
+		break;
+	case RBUG_OP_CONTEXT_LIST:
+		server_context_list(serial, s);
+		break;
+	case RBUG_OP_CONTEXT_INFO:
+		server_context_info((struct rbug_proto_context_info *)header, serial, s);
+		break;
+	case RBUG_OP_CONTEXT_DRAW_BLOCK:
+		block = (struct rbug_proto_context_draw_block *)header;
+		c = server_context(block->context, s);
+		if (c)
+			c->blocker |= block->block;
+		break;
+	case RBUG_OP_CONTEXT_DRAW_STEP:
+		step = (struct rbug_proto_context_draw_step *)header;
+		c = server_context(step->context, s);
+		if (c)
+			server_context_step(c, step->step, s);
+		break;
+	case RBUG_OP_CONTEXT_DRAW_UNBLOCK:
+		unblock = (struct rbug_proto_context_draw_unblock *)header;
+		c = server_context(unblock->context, s);
+		if (c) {
+			c->blocker &= ~unblock->unblock;
+			server_context_step(c, unblock->unblock, s);
+		}
+		break;
+	case RBUG_OP_CONTEXT_FLUSH:
+		s->frame++;
+		break;
+	case RBUG_OP_SHADER_LIST:
+		server_shader_list((struct rbug_proto_shader_list *)header, serial, s);
+		break;
+	case RBUG_OP_SHADER_INFO:
+		server_shader_info((struct rbug_proto_shader_info *)header, serial, s);
+		break;
+	case RBUG_OP_SHADER_DISABLE:
+		server_shader_disable((struct rbug_proto_shader_disable *)header, s);
+		break;
+	case RBUG_OP_SHADER_REPLACE:
+		server_shader_replace((struct rbug_proto_shader_replace *)header, s);
+		break;
+	default:
+		g_print("unhandled op %i\n", (int)header->opcode);
+		break;
+	}
+
+	return TRUE;
+}
+
+
+/*
+ * Main loop
+ */
+
+
+/**
+ * Draw every context that is due, returns ms until the next one is.
+ */
+static int server_run_contexts(struct server *s)
+{
+	struct server_context *c;
+	gint64 now = g_get_monotonic_time();
+	gint64 next = -1;
+	int i;
+
+	for (i = 0; i < s->num_contexts; i++) {
+		c = &s->contexts[i];
+		if (c->blocked)
+			continue;
+
+		if (c->next <= now)
+			server_draw(c, now, s);
+
+		if (!c->blocked && (next < 0 || c->next < next))
+			next = c->next;
+	}
+
+	if (next < 0)
+		return -1;
+
+	return (int)MAX((next - now + 999) / 1000, 0);
+}
+
+static void server_serve(int socket, struct server *s)
+{
+	struct rbug_header *header;
+	struct pollfd fd;
+	uint32_t serial;
+	int timeout;
+	int ret;
+	int i;
+
+	s->con = rbug_from_socket(socket);
+	for (i = 0; i < s->num_contexts; i++) {
+		s->contexts[i].blocker = 0;
+		s->contexts[i].blocked = 0;
+		s->contexts[i].next = 0;
+	}
+
+	while (1) {
+		timeout = server_run_contexts(s);
+
+		fd.fd = socket;
+		fd.events = POLLIN;
+		fd.revents = 0;
+
+		ret = poll(&fd, 1, timeout);
+		if (ret < 0 && errno != EINTR)
+			break;
+		if (ret <= 0)
+			continue;
+
+		header = rbug_get_message(s->con, &serial);
+		if (!header)
+			break;
+
+		server_handle(header, serial, s);
+		rbug_free_header(header);
+	}
+
+	rbug_disconnect(s->con);
+	s->con = NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct server server;
+	struct server *s = &server;
+	GOptionContext *context;
+	GError *error = NULL;
+	int listen, socket;
+	GOptionEntry entries[] = {
+		{ "port", 'p', 0, G_OPTION_ARG_INT, &s->port,
+		  "Port to listen on", "PORT" },
+		{ "contexts", 'c', 0, G_OPTION_ARG_INT, &s->num_contexts,
+		  "Number of contexts", "N" },
+		{ "textures", 't', 0, G_OPTION_ARG_INT, &s->num_textures,
+		  "Number of textures", "M" },
+		{ "shaders", 's', 0, G_OPTION_ARG_INT, &s->num_shaders,
+		  "Number of shaders per context", "K" },
+		{ "formats", 'f', 0, G_OPTION_ARG_STRING, &s->formats,
+		  "Comma separated texture formats, used in turn", "LIST" },
+		{ "sizes", 'z', 0, G_OPTION_ARG_STRING, &s->sizes,
+		  "Comma separated texture sizes, used in turn", "WxH,..." },
+		{ "interval", 'i', 0, G_OPTION_ARG_INT, &s->interval,
+		  "Time between draws in ms", "MS" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	memset(s, 0, sizeof(*s));
+	s->port = 13370;
+	s->num_contexts = 1;
+	s->num_textures = 16;
+	s->num_shaders = 4;
+	s->interval = 16;
+
+	context = g_option_context_new("- stand in rbug server");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (!s->formats)
+		s->formats = g_strdup("B8G8R8A8_UNORM");
+	if (!s->sizes)
+		s->sizes = g_strdup("256x256");
+
+	s->num_contexts = MAX(s->num_contexts, 0);
+	s->num_textures = MAX(s->num_textures, 0);
+	s->num_shaders = MAX(s->num_shaders, 0);
+	s->interval = MAX(s->interval, 1);
+
+	if (!server_setup(s))
+		return 1;
+
+	u_socket_init();
+
+	listen = u_socket_listen_on_port(s->port);
+	if (listen < 0) {
+		g_printerr("failed to listen on port %i\n", s->port);
+		return 1;
+	}
+
+	g_print("listening on port %i\n", s->port);
+
+	/* one client at a time, forever */
+	while (1) {
+		socket = u_socket_accept(listen);
+		if (socket < 0)
+			continue;
+
+		u_socket_block(socket, TRUE);
+		server_serve(socket, s);
+		u_socket_close(socket);
+	}
+
+	return 0;
+}
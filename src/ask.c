@@ -25,34 +25,316 @@
 #include "program.h"
 #include "util/u_network.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
-gboolean ask_connect(struct program *p)
+#include <gio/gio.h>
+
+/* ports tried, starting at p->ask.port */
+#define ASK_PORTS 10
+
+/* overall time allowed for resolving and connecting, in ms */
+#define ASK_TIMEOUT 5000
+
+/* wait between reconnect attempts, doubled each time, in ms */
+#define ASK_BACKOFF_MIN 250
+#define ASK_BACKOFF_MAX 8000
+
+/*
+ * Connecting resolves the host off the main thread and then tries every
+ * address and port at once with non-blocking connects, whichever answers
+ * first is used and the rest are dropped.
+ */
+
+struct ask_probe
+{
+	struct program *p;
+	int fd;
+	uint16_t port;
+
+	GIOChannel *channel;
+	guint watch;
+};
+
+static void ask_probe_free(struct ask_probe *probe, gboolean close_fd)
 {
-	uint16_t port = p->ask.port;
-	int socket = -1;
+	struct program *p = probe->p;
+
+	p->ask.probes = g_list_remove(p->ask.probes, probe);
 
-	while (socket < 0) {
-		/* after ten tries quit */
-		if (port >= p->ask.port + 10)
-			return false;
+	g_source_remove(probe->watch);
+	g_io_channel_unref(probe->channel);
 
-		socket = u_socket_connect(p->ask.host, port++);
+	if (close_fd)
+		close(probe->fd);
+
+	g_free(probe);
+}
+
+static void ask_connect_stop(struct program *p)
+{
+	while (p->ask.probes)
+		ask_probe_free(p->ask.probes->data, TRUE);
+
+	if (p->ask.cancel) {
+		g_cancellable_cancel(p->ask.cancel);
+		g_object_unref(p->ask.cancel);
+		p->ask.cancel = NULL;
 	}
 
-	/* store the actual port, minus one */
-	p->ask.port = --port;
+	if (p->ask.timeout)
+		g_source_remove(p->ask.timeout);
+	p->ask.timeout = 0;
+
+	p->ask.connecting = FALSE;
+}
+
+static void ask_connect_failed(const char *why, struct program *p)
+{
+	ask_connect_stop(p);
+
+	g_print("failed to connect to %s: %s\n", p->ask.host, why);
+
+	/* lost a connection we had, keep trying */
+	if (p->main.window)
+		ask_reconnect(p);
+	/* nothing to go back to */
+	else if (!p->ask.window)
+		main_quit(p);
+}
+
+static void ask_connected(int socket, uint16_t port, struct program *p)
+{
+	ask_connect_stop(p);
+
+	/* store the actual port */
+	p->ask.port = port;
 
 	p->rbug.socket = socket;
-	p->rbug.con = rbug_from_socket(socket);
 
-	rbug_glib_io_watch(p);
+	/* the network thread sets up the connection */
+	if (!rbug_glib_io_watch(p)) {
+		u_socket_close(socket);
+		ask_connect_failed("could not set up connection", p);
+		return;
+	}
+
+	p->ask.backoff = 0;
+
+	if (p->main.window) {
+		main_reconnected(p);
+		return;
+	}
 
 	main_window_create(p);
 
-	return true;
+	if (p->ask.window) {
+		gtk_widget_destroy(p->ask.window);
+
+		p->ask.window = NULL;
+		p->ask.entry_host = NULL;
+		p->ask.entry_port = NULL;
+	}
+}
+
+static gboolean ask_probe_event(GIOChannel *channel, GIOCondition c, gpointer data)
+{
+	struct ask_probe *probe = (struct ask_probe *)data;
+	struct program *p = probe->p;
+	socklen_t len = sizeof(int);
+	uint16_t port = probe->port;
+	int fd = probe->fd;
+	int error = 0;
+	(void)channel;
+	(void)c;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+		error = errno;
+
+	if (error) {
+		ask_probe_free(probe, TRUE);
+
+		if (!p->ask.probes && !p->ask.cancel)
+			ask_connect_failed("connection refused", p);
+
+		return false;
+	}
+
+	/* stays non-blocking, see net_flush */
+	ask_probe_free(probe, FALSE);
+
+	ask_connected(fd, port, p);
+
+	return false;
 }
 
-static void connect(GtkWidget *widget, gpointer data)
+static void ask_probe_start(GInetAddress *address, uint16_t port, struct program *p)
+{
+	gint mask = (G_IO_OUT | G_IO_ERR | G_IO_HUP | G_IO_NVAL);
+	struct ask_probe *probe;
+	GSocketAddress *addr;
+	gpointer native;
+	gssize len;
+	int fd;
+
+	addr = g_inet_socket_address_new(address, port);
+	len = g_socket_address_get_native_size(addr);
+	native = g_malloc(len);
+
+	if (!g_socket_address_to_native(addr, native, len, NULL))
+		goto out;
+
+	fd = socket(((struct sockaddr *)native)->sa_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		goto out;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	if (connect(fd, native, len) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		goto out;
+	}
+
+	probe = g_malloc(sizeof(*probe));
+	probe->p = p;
+	probe->fd = fd;
+	probe->port = port;
+	probe->channel = g_io_channel_unix_new(fd);
+	probe->watch = g_io_add_watch(probe->channel, mask, ask_probe_event, probe);
+
+	p->ask.probes = g_list_prepend(p->ask.probes, probe);
+
+out:
+	g_free(native);
+	g_object_unref(addr);
+}
+
+static void ask_resolved(GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct program *p = (struct program *)data;
+	GError *error = NULL;
+	GList *addresses;
+	GList *l;
+	unsigned i;
+
+	addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source), result, &error);
+
+	/* given up on already */
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_error_free(error);
+		return;
+	}
+
+	g_object_unref(p->ask.cancel);
+	p->ask.cancel = NULL;
+
+	if (!addresses) {
+		ask_connect_failed(error ? error->message : "unknown host", p);
+		if (error)
+			g_error_free(error);
+		return;
+	}
+
+	for (l = addresses; l; l = l->next)
+		for (i = 0; i < ASK_PORTS; i++)
+			ask_probe_start(l->data, p->ask.port + i, p);
+
+	g_resolver_free_addresses(addresses);
+
+	if (!p->ask.probes)
+		ask_connect_failed("could not create socket", p);
+}
+
+static gboolean ask_retry(gpointer data)
+{
+	struct program *p = (struct program *)data;
+
+	p->ask.retry = 0;
+	ask_connect(p);
+
+	return false;
+}
+
+static gboolean ask_timeout(gpointer data)
+{
+	struct program *p = (struct program *)data;
+
+	p->ask.timeout = 0;
+	ask_connect_failed("timed out", p);
+
+	return false;
+}
+
+
+/*
+ * Exported
+ */
+
+
+/**
+ * Start connecting to p->ask.host, the main window
+ * is created once connected. Never blocks.
+ */
+void ask_connect(struct program *p)
+{
+	GResolver *resolver;
+	int socket;
+
+	if (p->ask.connecting)
+		return;
+
+	/* play back a capture instead of connecting */
+	if (p->replay.file) {
+		socket = replay_start(p);
+		if (socket < 0)
+			ask_connect_failed("could not start replay", p);
+		else
+			ask_connected(socket, p->ask.port, p);
+		return;
+	}
+
+	p->ask.connecting = TRUE;
+	p->ask.cancel = g_cancellable_new();
+	p->ask.timeout = g_timeout_add(ASK_TIMEOUT, ask_timeout, p);
+
+	resolver = g_resolver_get_default();
+	g_resolver_lookup_by_name_async(resolver, p->ask.host, p->ask.cancel, ask_resolved, p);
+	g_object_unref(resolver);
+}
+
+/**
+ * Try ask_connect again after a while, waiting twice
+ * as long each time up to ASK_BACKOFF_MAX.
+ */
+void ask_reconnect(struct program *p)
+{
+	if (p->ask.retry)
+		return;
+
+	if (p->ask.backoff)
+		p->ask.backoff = MIN(p->ask.backoff * 2, ASK_BACKOFF_MAX);
+	else
+		p->ask.backoff = ASK_BACKOFF_MIN;
+
+	p->ask.retry = g_timeout_add(p->ask.backoff, ask_retry, p);
+}
+
+/**
+ * Give up on any connect or reconnect in progress.
+ */
+void ask_stop(struct program *p)
+{
+	ask_connect_stop(p);
+
+	if (p->ask.retry)
+		g_source_remove(p->ask.retry);
+	p->ask.retry = 0;
+}
+
+
+static void connect_clicked(GtkWidget *widget, gpointer data)
 {
 	struct program *p = (struct program *)data;
 	char *host;
@@ -60,20 +342,17 @@ static void connect(GtkWidget *widget, gpointer data)
 
 	(void)widget;
 
+	if (p->ask.connecting)
+		return;
+
 	host = gtk_editable_get_chars(GTK_EDITABLE(p->ask.entry_host), 0, -1);
 	port = (uint16_t)gtk_adjustment_get_value(p->ask.adjustment_port);
 
+	g_free(p->ask.host);
 	p->ask.host = host;
 	p->ask.port = port;
 
-	if (!ask_connect(p))
-		return;
-
-	gtk_widget_destroy(p->ask.window);
-
-	p->ask.window = NULL;
-	p->ask.entry_host = NULL;
-	p->ask.entry_port = NULL;
+	ask_connect(p);
 }
 
 static void destroy(GtkWidget *widget, gpointer data)
@@ -108,7 +387,7 @@ void ask_window_create(struct program *p)
 	adjustment_port = GTK_ADJUSTMENT(gtk_builder_get_object(builder, "adjustment_port"));
 
 	/* manualy set up signals */
-	g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(connect), p);
+	g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(connect_clicked), p);
 	g_signal_connect(G_OBJECT(quit), "clicked", G_CALLBACK(destroy), p);
 	g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(destroy), p);
 
@@ -0,0 +1,423 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Scripted benchmark, see --bench and "make bench".
+ *
+ * Each scenario drives the normal UI paths (selection, toolbar buttons)
+ * and an iteration counts as done once a fence sent after it has come
+ * back and no request is left queued or in flight. Results are printed
+ * as one JSON object per scenario on stdout.
+ */
+
+#include "program.h"
+
+#include <stdlib.h>
+#include <sys/resource.h>
+
+/* poll interval for iteration completion, in ms */
+#define BENCH_TICK 1
+
+/* give up on an iteration after this long, in us */
+#define BENCH_TIMEOUT (30 * 1000 * 1000)
+
+struct bench_scenario
+{
+	const char *name;
+	unsigned iterations;
+
+	/* FALSE to skip the scenario */
+	gboolean (*setup)(struct program *p);
+	void (*iterate)(unsigned i, struct program *p);
+	/* extra condition for an iteration to be done, may be NULL */
+	gboolean (*done)(struct program *p);
+	void (*teardown)(struct program *p);
+};
+
+/* fence sent by bench_kick, see bench_fenced */
+struct bench_fence
+{
+	struct rbug_event e;
+
+	guint kick;
+};
+
+struct bench_find
+{
+	enum types type;
+	gboolean last;
+	gboolean found;
+	GtkTreeIter iter;
+};
+
+static gboolean bench_find_func(GtkTreeModel *model, GtkTreePath *path,
+                                GtkTreeIter *iter, gpointer data)
+{
+	struct bench_find *find = (struct bench_find *)data;
+	gint type;
+	(void)path;
+
+	gtk_tree_model_get(model, iter, COLUMN_TYPE, &type, -1);
+
+	if (type != (gint)find->type)
+		return FALSE;
+
+	find->iter = *iter;
+	find->found = TRUE;
+
+	return !find->last;
+}
+
+/**
+ * Select the first, or last, row of type in the tree.
+ */
+static gboolean bench_select(enum types type, gboolean last, struct program *p)
+{
+	GtkTreeSelection *selection = gtk_tree_view_get_selection(p->main.treeview);
+	struct bench_find find;
+
+	memset(&find, 0, sizeof(find));
+	find.type = type;
+	find.last = last;
+
+	gtk_tree_model_foreach(GTK_TREE_MODEL(p->main.store), bench_find_func, &find);
+	if (!find.found)
+		return FALSE;
+
+	gtk_tree_selection_unselect_all(selection);
+	gtk_tree_selection_select_iter(selection, &find.iter);
+
+	return TRUE;
+}
+
+
+/*
+ * Scenarios
+ */
+
+
+static gboolean bench_refresh_setup(struct program *p)
+{
+	gtk_tree_selection_unselect_all(gtk_tree_view_get_selection(p->main.treeview));
+
+	return TRUE;
+}
+
+static void bench_refresh_iterate(unsigned i, struct program *p)
+{
+	(void)i;
+
+	g_signal_emit_by_name(p->tool.refresh, "clicked");
+}
+
+static gboolean bench_texture_setup(struct program *p)
+{
+	(void)p;
+
+	return TRUE;
+}
+
+static void bench_texture_iterate(unsigned i, struct program *p)
+{
+	/* the first download comes from selecting it, then refresh */
+	if (i == 0)
+		bench_select(TYPE_TEXTURE, TRUE, p);
+	else
+		g_signal_emit_by_name(p->tool.refresh, "clicked");
+}
+
+/*
+ * Downloaded and uploaded, pool conversion included. Tiled the refresh
+ * only invalidates, so it is done once the tiles were drawn since and
+ * none of those the draw asked for are still coming.
+ */
+static gboolean bench_texture_done(struct program *p)
+{
+	if (p->texture.id != p->selected.id || p->texture.read)
+		return FALSE;
+
+	if (!p->texture.tiled)
+		return TRUE;
+
+	return p->texture.tiles_draws != p->bench.draws &&
+	       g_hash_table_size(p->texture.tiles_pending) == 0;
+}
+
+static gboolean bench_step_setup(struct program *p)
+{
+	if (!bench_select(TYPE_CONTEXT, FALSE, p))
+		return FALSE;
+
+	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(p->tool.break_before), TRUE);
+
+	return TRUE;
+}
+
+static void bench_step_iterate(unsigned i, struct program *p)
+{
+	(void)i;
+
+	g_signal_emit_by_name(p->tool.step, "clicked");
+}
+
+/* stepped and blocked on the next draw */
+static gboolean bench_step_done(struct program *p)
+{
+	return p->context.blocked_count != p->bench.blocked_count;
+}
+
+static void bench_step_teardown(struct program *p)
+{
+	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(p->tool.break_before), FALSE);
+}
+
+static gboolean bench_shader_setup(struct program *p)
+{
+	return bench_select(TYPE_SHADER, FALSE, p);
+}
+
+static void bench_shader_iterate(unsigned i, struct program *p)
+{
+	if (i % 2)
+		g_signal_emit_by_name(p->tool.enable, "clicked");
+	else
+		g_signal_emit_by_name(p->tool.disable, "clicked");
+}
+
+static const struct bench_scenario bench_scenarios[] = {
+	{ "refresh", 5, bench_refresh_setup, bench_refresh_iterate, NULL, NULL },
+	{ "texture", 10, bench_texture_setup, bench_texture_iterate, bench_texture_done, NULL },
+	{ "step", 1000, bench_step_setup, bench_step_iterate, bench_step_done, bench_step_teardown },
+	{ "shader", 100, bench_shader_setup, bench_shader_iterate, NULL, NULL },
+};
+
+#define BENCH_NUM_SCENARIOS (sizeof(bench_scenarios) / sizeof(bench_scenarios[0]))
+
+
+/*
+ * Runner
+ */
+
+
+static gboolean bench_fenced(struct rbug_event *e, struct rbug_header *header,
+                             struct program *p)
+{
+	struct bench_fence *fence = (struct bench_fence *)e;
+	(void)header;
+
+	/* a fence from before a timeout says nothing about this kick */
+	if (fence->kick == p->bench.kick)
+		p->bench.fenced = TRUE;
+
+	g_free(fence);
+
+	return FALSE;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	gint64 x = *(const gint64 *)a;
+	gint64 y = *(const gint64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double bench_ms(gint64 us)
+{
+	return us / 1000.0;
+}
+
+static void bench_report(const struct bench_scenario *s, const char *error,
+                         struct program *p)
+{
+	GArray *lat = p->bench.latencies;
+	gint64 *v = (gint64 *)(void *)lat->data;
+	guint64 sent, received;
+	struct rusage usage;
+	unsigned n = lat->len;
+
+	stats_totals(&sent, &received, p);
+	getrusage(RUSAGE_SELF, &usage);
+
+	qsort(v, n, sizeof(*v), bench_compare);
+
+	printf("{\"scenario\": \"%s\", \"iterations\": %u, \"wall_ms\": %.3f, "
+	       "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+	       "\"bytes_sent\": %" G_GUINT64_FORMAT ", \"bytes_received\": %" G_GUINT64_FORMAT ", "
+	       "\"peak_rss_kb\": %ld",
+	       s->name, n,
+	       bench_ms(g_get_monotonic_time() - p->bench.scenario_start),
+	       bench_ms(n ? v[(n - 1) / 2] : 0),
+	       bench_ms(n ? v[(n - 1) * 99 / 100] : 0),
+	       bench_ms(n ? v[n - 1] : 0),
+	       sent - p->bench.sent, received - p->bench.received,
+	       (long)usage.ru_maxrss);
+
+	if (error)
+		printf(", \"error\": \"%s\"", error);
+
+	printf("}\n");
+	fflush(stdout);
+
+	if (error)
+		p->bench.failed = TRUE;
+}
+
+static void bench_next_scenario(struct program *p)
+{
+	const struct bench_scenario *s = &bench_scenarios[p->bench.scenario];
+
+	if (s->teardown)
+		s->teardown(p);
+
+	p->bench.scenario++;
+	p->bench.started = FALSE;
+	g_array_set_size(p->bench.latencies, 0);
+}
+
+/**
+ * Kick off iteration i, or the setup if i is -1.
+ */
+static void bench_kick(const struct bench_scenario *s, int i, struct program *p)
+{
+	struct bench_fence *fence;
+
+	p->bench.blocked_count = p->context.blocked_count;
+	p->bench.draws = p->texture.tiles_draws;
+	p->bench.iteration_start = g_get_monotonic_time();
+
+	if (i >= 0)
+		s->iterate(i, p);
+
+	fence = g_malloc(sizeof(*fence));
+	memset(fence, 0, sizeof(*fence));
+
+	fence->e.func = bench_fenced;
+	fence->kick = ++p->bench.kick;
+
+	p->bench.fenced = FALSE;
+	rbug_fence(&fence->e, p);
+	p->bench.waiting = TRUE;
+}
+
+static gboolean bench_tick(gpointer data)
+{
+	struct program *p = (struct program *)data;
+	const struct bench_scenario *s;
+	gint64 now = g_get_monotonic_time();
+	gint64 took;
+
+	if (p->bench.scenario >= BENCH_NUM_SCENARIOS) {
+		p->bench.timer = 0;
+		main_quit(p);
+		return false;
+	}
+
+	s = &bench_scenarios[p->bench.scenario];
+
+	if (p->bench.waiting) {
+		took = now - p->bench.iteration_start;
+
+		if (!p->bench.fenced || rbug_busy(p) ||
+		    (p->bench.iteration >= 0 && s->done && !s->done(p))) {
+			if (took > BENCH_TIMEOUT) {
+				p->bench.waiting = FALSE;
+				bench_report(s, "timeout", p);
+				bench_next_scenario(p);
+			}
+			return true;
+		}
+
+		p->bench.waiting = FALSE;
+		if (p->bench.iteration >= 0)
+			g_array_append_val(p->bench.latencies, took);
+		p->bench.iteration++;
+	}
+
+	if (!p->bench.started) {
+		p->bench.started = TRUE;
+		p->bench.iteration = -1;
+
+		if (!s->setup(p)) {
+			p->bench.scenario_start = g_get_monotonic_time();
+			bench_report(s, "setup failed", p);
+			bench_next_scenario(p);
+			return true;
+		}
+
+		/* wait for whatever the setup started */
+		bench_kick(s, -1, p);
+		return true;
+	}
+
+	if (p->bench.iteration == 0 && !p->bench.latencies->len) {
+		/* setup is not part of the numbers */
+		p->bench.scenario_start = g_get_monotonic_time();
+		stats_totals(&p->bench.sent, &p->bench.received, p);
+	}
+
+	if ((unsigned)p->bench.iteration >= s->iterations) {
+		bench_report(s, NULL, p);
+		bench_next_scenario(p);
+		return true;
+	}
+
+	bench_kick(s, p->bench.iteration, p);
+
+	return true;
+}
+
+
+/*
+ * Exported
+ */
+
+
+/**
+ * Start running the scenarios, main_quit is called when done.
+ */
+void bench_start(struct program *p)
+{
+	p->bench.latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+	p->bench.scenario = 0;
+	p->bench.started = FALSE;
+	p->bench.iteration = -1;
+
+	/* let the initial refresh finish first */
+	bench_kick(NULL, -1, p);
+
+	p->bench.timer = g_timeout_add(BENCH_TICK, bench_tick, p);
+}
+
+void bench_stop(struct program *p)
+{
+	if (p->bench.timer)
+		g_source_remove(p->bench.timer);
+	p->bench.timer = 0;
+
+	if (p->bench.latencies)
+		g_array_free(p->bench.latencies, TRUE);
+	p->bench.latencies = NULL;
+}
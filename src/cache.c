@@ -0,0 +1,248 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Uploaded textures, so going back to something viewed a moment ago
+ * does not download and convert it again.
+ *
+ * Entries are GL texture objects keyed by (texture, level, layer, tile),
+ * tile is 0 for the whole level, see TEXTURE_TILE. They are kept in
+ * least recently used order, once the estimated size of all of
+ * them goes over the budget the oldest are deleted. cache_invalidate
+ * only bumps a generation, entries from an older one are no longer
+ * found but are still good for showing until replaced or evicted.
+ */
+
+#include "program.h"
+
+#include "GL/gl.h"
+
+/* default budget, in MiB, see --texture-cache */
+#define CACHE_BUDGET 256
+
+static guint cache_hash(gconstpointer key)
+{
+	const struct cache_texture *t = key;
+
+	return g_int64_hash(&t->id) ^ (t->level << 24) ^ t->layer ^ (t->tile * 2654435761u);
+}
+
+static gboolean cache_equal(gconstpointer a, gconstpointer b)
+{
+	const struct cache_texture *x = a;
+	const struct cache_texture *y = b;
+
+	return x->id == y->id && x->level == y->level &&
+	       x->layer == y->layer && x->tile == y->tile;
+}
+
+/* needs the GL context to be current */
+static void cache_remove(struct cache_texture *t, struct program *p)
+{
+	GLuint tex = t->tex;
+
+	g_hash_table_remove(p->cache.hash, t);
+	g_queue_unlink(&p->cache.lru, &t->link);
+	p->cache.used -= t->size;
+
+	glDeleteTextures(1, &tex);
+	g_free(t->hashes);
+	g_free(t);
+}
+
+
+/*
+ * Exported
+ */
+
+
+void cache_init(struct program *p)
+{
+	if (p->cache.budget <= 0)
+		p->cache.budget = CACHE_BUDGET;
+
+	p->cache.hash = g_hash_table_new(cache_hash, cache_equal);
+	g_queue_init(&p->cache.lru);
+}
+
+/**
+ * The GL objects go away with the context, just free the entries.
+ */
+void cache_fini(struct program *p)
+{
+	struct cache_texture *t;
+	GList *link;
+
+	while ((link = g_queue_pop_head_link(&p->cache.lru))) {
+		t = link->data;
+		g_free(t->hashes);
+		g_free(t);
+	}
+
+	g_hash_table_destroy(p->cache.hash);
+	p->cache.hash = NULL;
+	p->cache.used = 0;
+}
+
+/**
+ * Look up a texture uploaded since the last cache_invalidate,
+ * marking it as the most recently used.
+ */
+struct cache_texture * cache_get(rbug_texture_t id, unsigned level, unsigned layer,
+                                 guint tile, struct program *p)
+{
+	struct cache_texture key;
+	struct cache_texture *t;
+
+	key.id = id;
+	key.level = level;
+	key.layer = layer;
+	key.tile = tile;
+
+	t = g_hash_table_lookup(p->cache.hash, &key);
+	if (!t || t->generation != p->cache.generation)
+		return NULL;
+
+	g_queue_unlink(&p->cache.lru, &t->link);
+	g_queue_push_head_link(&p->cache.lru, &t->link);
+
+	return t;
+}
+
+/**
+ * Like cache_get but also finds entries from before the last
+ * cache_invalidate and leaves the order alone.
+ */
+struct cache_texture * cache_find(rbug_texture_t id, unsigned level, unsigned layer,
+                                  guint tile, struct program *p)
+{
+	struct cache_texture key;
+
+	key.id = id;
+	key.level = level;
+	key.layer = layer;
+	key.tile = tile;
+
+	return g_hash_table_lookup(p->cache.hash, &key);
+}
+
+/**
+ * Get the entry to upload (id, level, layer, tile) into and bind its
+ * texture, an older upload of the same is reused. Call cache_sized
+ * once the data is in. Needs the GL context to be current.
+ */
+struct cache_texture * cache_add(rbug_texture_t id, unsigned level, unsigned layer,
+                                 guint tile, struct program *p)
+{
+	struct cache_texture key;
+	struct cache_texture *t;
+	GLuint tex;
+
+	key.id = id;
+	key.level = level;
+	key.layer = layer;
+	key.tile = tile;
+
+	t = g_hash_table_lookup(p->cache.hash, &key);
+	if (t) {
+		g_queue_unlink(&p->cache.lru, &t->link);
+		p->cache.used -= t->size;
+		t->size = 0;
+	} else {
+		t = g_malloc(sizeof(*t));
+		memset(t, 0, sizeof(*t));
+
+		t->id = id;
+		t->level = level;
+		t->layer = layer;
+		t->tile = tile;
+		t->link.data = t;
+
+		glGenTextures(1, &tex);
+		t->tex = tex;
+
+		g_hash_table_insert(p->cache.hash, t, t);
+	}
+
+	t->generation = p->cache.generation;
+	g_queue_push_head_link(&p->cache.lru, &t->link);
+
+	glBindTexture(GL_TEXTURE_2D, t->tex);
+
+	return t;
+}
+
+/**
+ * Account for what was uploaded into t and evict the least recently
+ * used entries over budget. The one on screen is never evicted. Needs
+ * the GL context to be current.
+ */
+void cache_sized(struct cache_texture *t, size_t size, struct program *p)
+{
+	size_t budget = (size_t)p->cache.budget * 1024 * 1024;
+	struct cache_texture *old;
+	GList *l, *prev;
+
+	t->size = size;
+	p->cache.used += size;
+
+	/* walk from the oldest, stepping over the ones that have to stay */
+	for (l = p->cache.lru.tail; l && p->cache.used > budget; l = prev) {
+		prev = l->prev;
+		old = l->data;
+
+		if (old == t || old->tex == p->texture.tex)
+			continue;
+
+		cache_remove(old, p);
+	}
+}
+
+/**
+ * Contents may have changed, textures are downloaded again when next
+ * viewed. Called on step, flush and refresh.
+ */
+void cache_invalidate(struct program *p)
+{
+	p->cache.generation++;
+
+	/* thumbnails on screen are stale too */
+	main_visible_schedule(p);
+}
+
+/**
+ * Like cache_invalidate but only for the levels and tiles of one texture.
+ */
+void cache_invalidate_texture(rbug_texture_t id, struct program *p)
+{
+	struct cache_texture *t;
+	GList *l;
+
+	for (l = p->cache.lru.head; l; l = l->next) {
+		t = l->data;
+		if (t->id == id)
+			t->generation = p->cache.generation - 1;
+	}
+}
@@ -38,6 +38,10 @@ context_start_info_action(rbug_context_t c, GtkTreeIter *iter, gboolean force_up
 static void
 context_stop_info_action(struct context_action_info *info, struct program *p);
 
+static void context_start_list_action(struct store *store,
+                                      GtkTreeIter *parent,
+                                      struct program *p);
+
 
 /*
  * Private
@@ -114,6 +118,11 @@ static void step(GtkWidget *widget, struct program *p)
 
 	rbug_send_context_draw_step(con, p->selected.id,
 	                            RBUG_BLOCK_BEFORE | RBUG_BLOCK_AFTER, NULL);
+
+	/* until it blocks again */
+	g_hash_table_remove(p->context.blocked, &p->selected.id);
+
+	cache_invalidate(p);
 }
 
 static void flush(GtkWidget *widget, struct program *p)
@@ -121,6 +130,7 @@ static void flush(GtkWidget *widget, struct program *p)
 	(void)widget;
 
 	rbug_send_context_flush(p->rbug.con, p->selected.id, NULL);
+	cache_invalidate(p);
 
 	context_start_info_action(p->selected.id, &p->selected.iter, FALSE, p);
 }
@@ -131,6 +141,11 @@ static gboolean blocked(struct rbug_event *e, struct rbug_header *h, struct prog
 	GtkTreeIter iter;
 	(void)e;
 
+	p->context.blocked_count++;
+	g_hash_table_add(p->context.blocked, g_memdup(&b->context, sizeof(b->context)));
+
+	/* a draw just went through */
+	cache_invalidate(p);
 
 	rbug_send_context_flush(p->rbug.con, b->context, NULL);
 
@@ -148,32 +163,9 @@ static gboolean blocked(struct rbug_event *e, struct rbug_header *h, struct prog
  */
 
 
-void context_list(GtkTreeStore *store, GtkTreeIter *parent, struct program *p)
+void context_list(struct store *store, GtkTreeIter *parent, struct program *p)
 {
-	struct rbug_proto_context_list_reply *list;
-	struct rbug_connection *con = p->rbug.con;
-	struct rbug_header *header;
-	uint32_t i;
-
-	rbug_send_context_list(con, NULL);
-	header = rbug_get_message(con, NULL);
-	list = (struct rbug_proto_context_list_reply *)header;
-
-	g_assert(header);
-	g_assert(header->opcode == RBUG_OP_CONTEXT_LIST_REPLY);
-
-	for (i = 0; i < list->contexts_len; i++) {
-		GtkTreeIter iter;
-		gtk_tree_store_insert_with_values(store, &iter, parent, -1,
-		                                  COLUMN_ID, list->contexts[i],
-		                                  COLUMN_TYPE, TYPE_CONTEXT,
-		                                  COLUMN_TYPENAME, "context",
-		                                  -1);
-
-		shader_list(store, &iter, list->contexts[i], p);
-	}
-
-	rbug_free_header(header);
+	context_start_list_action(store, parent, p);
 }
 
 void context_unselected(struct program *p)
@@ -217,8 +209,31 @@ void context_selected(struct program *p)
 	context_start_info_action(p->selected.id, &p->selected.iter, FALSE, p);
 }
 
+/**
+ * Is every known context blocked on a draw, nothing
+ * can change until one is stepped or unblocked.
+ */
+gboolean context_all_blocked(struct program *p)
+{
+	return p->context.num &&
+	       g_hash_table_size(p->context.blocked) >= p->context.num;
+}
+
+/**
+ * Contexts may have been stepped or unblocked while the connection was
+ * down, forget what was blocked until told again.
+ */
+void context_reconnected(struct program *p)
+{
+	g_hash_table_remove_all(p->context.blocked);
+
+	if (p->selected.type == TYPE_CONTEXT)
+		context_start_info_action(p->selected.id, &p->selected.iter, FALSE, p);
+}
+
 void context_init(struct program *p)
 {
+	p->context.blocked = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
 	p->context.blocked_event.func = blocked;
 
 	rbug_add_event(&p->context.blocked_event, RBUG_OP_CONTEXT_DRAW_BLOCKED, p);
@@ -278,7 +293,12 @@ static gboolean context_action_info_info(struct rbug_event *e,
 	else
 		buf = icon_get("shader_on_normal", p);
 
-	gtk_tree_store_set(p->main.treestore, &action->iter, COLUMN_PIXBUF, buf, -1);
+	store_set_pixbuf(p->main.store, &action->iter, buf);
+
+	if (info->blocked)
+		g_hash_table_add(p->context.blocked, g_memdup(&action->cid, sizeof(action->cid)));
+	else
+		g_hash_table_remove(p->context.blocked, &action->cid);
 
 	/* if this context is not currently selected */
 	if (action->cid != p->selected.id)
@@ -382,29 +402,37 @@ out:
 	return FALSE;
 }
 
+static int16_t context_action_info_send(struct rbug_event *e,
+                                        uint32_t *serial,
+                                        struct program *p)
+{
+	struct context_action_info *action = (struct context_action_info *)e;
+
+	rbug_send_context_info(p->rbug.con, action->cid, serial);
+
+	return RBUG_OP_CONTEXT_INFO;
+}
+
 static struct context_action_info *
 context_start_info_action(rbug_context_t c,
                           GtkTreeIter *iter,
                           gboolean force_update,
                           struct program *p)
 {
-	struct rbug_connection *con = p->rbug.con;
 	struct context_action_info *action;
-	uint32_t serial = 0;
 
 	action = g_malloc(sizeof(*action));
 	memset(action, 0, sizeof(*action));
 
-	rbug_send_context_info(con, c, &serial);
-
 	action->e.func = context_action_info_info;
+	action->e.send = context_action_info_send;
 	action->cid = c;
 	action->iter = *iter;
 	action->pending = TRUE;
 	action->running = TRUE;
 	action->update = force_update;
 
-	rbug_add_reply(&action->e, serial, p);
+	rbug_queue_shared(&action->e, RBUG_OP_CONTEXT_INFO, c, RBUG_LANE_INTERACTIVE, p);
 
 	return action;
 }
@@ -419,3 +447,86 @@ static void context_stop_info_action(struct context_action_info *action, struct
 	if (!action->pending)
 		context_action_info_clean(action, p);
 }
+
+struct context_action_list
+{
+	struct rbug_event e;
+
+	struct store *store;
+	GtkTreeIter parent;
+};
+
+static gboolean context_action_list_list(struct rbug_event *e,
+                                         struct rbug_header *header,
+                                         struct program *p)
+{
+	struct rbug_proto_context_list_reply *list;
+	struct context_action_list *action;
+	struct store *store;
+	struct main_child *child;
+	GtkTreeIter *parent;
+	GHashTableIter it;
+	GHashTable *rows;
+	gpointer key;
+	uint32_t i;
+
+	action = (struct context_action_list *)e;
+	list = (struct rbug_proto_context_list_reply *)header;
+	parent = &action->parent;
+	store = action->store;
+
+	g_assert(header->opcode == RBUG_OP_CONTEXT_LIST_REPLY);
+
+	rows = main_sync_children(parent, TYPE_CONTEXT, list->contexts,
+	                          list->contexts_len, p);
+
+	/* forget destroyed contexts */
+	g_hash_table_iter_init(&it, p->context.blocked);
+	while (g_hash_table_iter_next(&it, &key, NULL))
+		if (!g_hash_table_lookup(rows, key))
+			g_hash_table_iter_remove(&it);
+
+	p->context.num = list->contexts_len;
+
+	main_add_children(parent, TYPE_CONTEXT, list->contexts,
+	                  list->contexts_len, rows, p);
+
+	/* known contexts too, their shaders might still have changed */
+	for (i = 0; i < list->contexts_len; i++) {
+		child = g_hash_table_lookup(rows, &list->contexts[i]);
+		shader_list(store, &child->iter, list->contexts[i], p);
+	}
+
+	g_hash_table_destroy(rows);
+	g_free(action);
+
+	return FALSE;
+}
+
+static int16_t context_action_list_send(struct rbug_event *e,
+                                        uint32_t *serial,
+                                        struct program *p)
+{
+	(void)e;
+
+	rbug_send_context_list(p->rbug.con, serial);
+
+	return RBUG_OP_CONTEXT_LIST;
+}
+
+static void context_start_list_action(struct store *store,
+                                      GtkTreeIter *parent,
+                                      struct program *p)
+{
+	struct context_action_list *action;
+
+	action = g_malloc(sizeof(*action));
+	memset(action, 0, sizeof(*action));
+
+	action->e.func = context_action_list_list;
+	action->e.send = context_action_list_send;
+	action->store = store;
+	action->parent = *parent;
+
+	rbug_queue(&action->e, RBUG_LANE_BACKGROUND, p);
+}
@@ -164,6 +164,48 @@ static gboolean expose(GtkWidget* widget, GdkEventExpose* e, gpointer data)
 	return TRUE;
 }
 
+/* dragging with any button pans the texture view */
+static gboolean button_press(GtkWidget* widget, GdkEventButton* e, gpointer data)
+{
+	struct program *p = (struct program *)data;
+	(void)widget;
+
+	p->draw.drag_x = e->x;
+	p->draw.drag_y = e->y;
+
+	return TRUE;
+}
+
+static gboolean motion_notify(GtkWidget* widget, GdkEventMotion* e, gpointer data)
+{
+	struct program *p = (struct program *)data;
+	(void)widget;
+
+	if (p->viewed.type == TYPE_TEXTURE)
+		texture_pan(e->x - p->draw.drag_x, e->y - p->draw.drag_y, p);
+
+	p->draw.drag_x = e->x;
+	p->draw.drag_y = e->y;
+
+	return TRUE;
+}
+
+static gboolean scroll(GtkWidget* widget, GdkEventScroll* e, gpointer data)
+{
+	struct program *p = (struct program *)data;
+	(void)widget;
+
+	if (p->viewed.type != TYPE_TEXTURE)
+		return FALSE;
+
+	if (e->direction == GDK_SCROLL_UP)
+		texture_zoom(2.0, e->x, e->y, p);
+	else if (e->direction == GDK_SCROLL_DOWN)
+		texture_zoom(0.5, e->x, e->y, p);
+
+	return TRUE;
+}
+
 void draw_setup(GtkDrawingArea *draw, struct program *p)
 {
 	GObject *obj = G_OBJECT(draw);
@@ -171,7 +213,14 @@ void draw_setup(GtkDrawingArea *draw, struct program *p)
 	gtk_widget_set_gl_capability(GTK_WIDGET(draw), p->draw.config, NULL,
 	                             TRUE, GDK_GL_RGBA_TYPE);
 
+	gtk_widget_add_events(GTK_WIDGET(draw), GDK_BUTTON_PRESS_MASK |
+	                                        GDK_BUTTON_MOTION_MASK |
+	                                        GDK_SCROLL_MASK);
+
 	g_signal_connect_after(obj, "realize", G_CALLBACK(realize), p);
 	g_signal_connect(obj, "configure-event", G_CALLBACK(configure), p);
 	g_signal_connect(obj, "expose-event", G_CALLBACK(expose), p);
+	g_signal_connect(obj, "button-press-event", G_CALLBACK(button_press), p);
+	g_signal_connect(obj, "motion-notify-event", G_CALLBACK(motion_notify), p);
+	g_signal_connect(obj, "scroll-event", G_CALLBACK(scroll), p);
 }
@@ -25,12 +25,22 @@
 #include "program.h"
 #include "pipe/p_format.h"
 
+#include <signal.h>
+
+/* rows on screen are looked at once scrolling settles, in ms */
+#define MAIN_VISIBLE_DELAY 50
+
+/* rows looked at per update, in case the view is very tall */
+#define MAIN_VISIBLE_ROWS 256
+
+/* lists adding more rows than this are added off the view */
+#define MAIN_BATCH 256
+
 static gboolean main_idle(gpointer data)
 {
 	struct program *p = (struct program *)data;
 
-	if (!ask_connect(p))
-		main_quit(p);
+	ask_connect(p);
 
 	return false;
 }
@@ -38,22 +48,81 @@ static gboolean main_idle(gpointer data)
 int main(int argc, char *argv[])
 {
 	struct program *p = g_malloc(sizeof(*p));
+	GError *error = NULL;
+	gint port = 13370;
+	int ret;
+	GOptionEntry entries[] = {
+		{ "port", 0, 0, G_OPTION_ARG_INT,
+		  &port,
+		  "First port to try connecting to", "PORT" },
+		{ "window-interactive", 0, 0, G_OPTION_ARG_INT,
+		  &p->rbug.window[RBUG_LANE_INTERACTIVE],
+		  "Requests in flight for the viewed object", "N" },
+		{ "window-background", 0, 0, G_OPTION_ARG_INT,
+		  &p->rbug.window[RBUG_LANE_BACKGROUND],
+		  "Requests in flight for the object tree", "N" },
+		{ "stats", 0, 0, G_OPTION_ARG_FILENAME,
+		  &p->stats.file,
+		  "Write protocol statistics to FILE on exit", "FILE" },
+		{ "record", 0, 0, G_OPTION_ARG_FILENAME,
+		  &p->net.record_file,
+		  "Record all traffic to FILE", "FILE" },
+		{ "replay", 0, 0, G_OPTION_ARG_FILENAME,
+		  &p->replay.file,
+		  "Play back a recording instead of connecting", "FILE" },
+		{ "replay-fast", 0, 0, G_OPTION_ARG_NONE,
+		  &p->replay.fast,
+		  "Do not keep the recorded timing when playing back", NULL },
+		{ "texture-cache", 0, 0, G_OPTION_ARG_INT,
+		  &p->cache.budget,
+		  "Memory for recently viewed textures", "MB" },
+		{ "auto-rate", 0, 0, G_OPTION_ARG_INT,
+		  &p->texture.auto_rate,
+		  "Texture reads a second with Auto", "HZ" },
+		{ "reconnect", 0, 0, G_OPTION_ARG_NONE,
+		  &p->rbug.reconnect,
+		  "Keep reconnecting when the connection drops", NULL },
+		{ "bench", 0, 0, G_OPTION_ARG_NONE,
+		  &p->bench.enabled,
+		  "Run the benchmark scenarios and quit", NULL },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
 	memset(p, 0, sizeof(*p));
 
-	gtk_init(&argc, &argv);
+	p->rbug.window[RBUG_LANE_INTERACTIVE] = RBUG_WINDOW_INTERACTIVE;
+	p->rbug.window[RBUG_LANE_BACKGROUND] = RBUG_WINDOW_BACKGROUND;
+	p->texture.auto_rate = TEXTURE_AUTO_RATE;
+
+	stats_init(p);
+
+	if (!gtk_init_with_args(&argc, &argv, "[host]", entries, NULL, &error)) {
+		g_printerr("%s\n", error ? error->message : "failed to init gtk");
+		return 1;
+	}
 	gtk_gl_init(&argc, &argv);
 
+	cache_init(p);
+	unpack_init(p);
+
+	/* sends while reconnecting go to a closed socket */
+	if (p->rbug.reconnect)
+		signal(SIGPIPE, SIG_IGN);
+
 	p->draw.config = gdk_gl_config_new_by_mode(GDK_GL_MODE_RGB |
 	                                           GDK_GL_MODE_ALPHA |
 	                                           GDK_GL_MODE_DEPTH |
 	                                           GDK_GL_MODE_DOUBLE);
 
 	/* connect to first non gnome argument */
-	if (argc > 1) {
+	if (p->replay.file) {
+		p->ask.host = g_strdup("replay");
+		gtk_idle_add(main_idle, p);
+	} else if (argc > 1) {
 		int len = strlen(argv[1]) + 1;
 		p->ask.host = g_malloc(len);
 		memcpy(p->ask.host, argv[1], len);
-		p->ask.port = 13370;
+		p->ask.port = port;
 		gtk_idle_add(main_idle, p);
 	} else {
 		ask_window_create(p);
@@ -61,9 +130,21 @@ int main(int argc, char *argv[])
 
 	gtk_main();
 
+	if (p->stats.file)
+		stats_dump(p->stats.file, p);
+
+	ret = p->bench.failed ? 1 : 0;
+
+	stats_fini(p);
+	thumb_fini(p);
+	texture_fini(p);
+	cache_fini(p);
+	g_free(p->stats.file);
+	g_free(p->net.record_file);
+	g_free(p->replay.file);
 	g_free(p);
 
-	return 0;
+	return ret;
 }
 
 static void destroy(GtkWidget *widget, gpointer data)
@@ -157,7 +238,7 @@ static void changed(GtkTreeSelection *s, gpointer data)
  */
 static void update_statusbar(struct program *p)
 {
-	GtkTreeModel *model = GTK_TREE_MODEL(p->main.treestore);
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
 	GValue string;
 
 	gtk_statusbar_pop(p->main.statusbar, p->main.sb_id);
@@ -204,10 +285,136 @@ static void row_changed(GtkTreeModel *model,
 	g_value_unset(&id);
 }
 
+/**
+ * Move iter to the next row shown in view, FALSE if there is none.
+ */
+static gboolean visible_next(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeView *view)
+{
+	GtkTreeIter child;
+	GtkTreeIter parent;
+	GtkTreePath *path;
+	gboolean expanded;
+
+	path = gtk_tree_model_get_path(model, iter);
+	expanded = gtk_tree_view_row_expanded(view, path);
+	gtk_tree_path_free(path);
+
+	if (expanded && gtk_tree_model_iter_children(model, &child, iter)) {
+		*iter = child;
+		return TRUE;
+	}
+
+	while (1) {
+		child = *iter;
+		if (gtk_tree_model_iter_next(model, iter))
+			return TRUE;
+		if (!gtk_tree_model_iter_parent(model, &parent, &child))
+			return FALSE;
+		*iter = parent;
+	}
+}
+
+/**
+ * Fetch what a row on screen shows but the list did not tell us.
+ */
+static void visible_row(GtkTreeIter *iter, struct program *p)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
+	GtkTreeIter parent;
+	guint64 parent_id;
+	guint64 id;
+	gint state;
+	gint type;
+
+	gtk_tree_model_get(model, iter,
+	                   COLUMN_ID, &id,
+	                   COLUMN_TYPE, &type,
+	                   COLUMN_INFO_STATE, &state,
+	                   -1);
+
+	if (state == INFO_NONE) {
+		if (type == TYPE_TEXTURE) {
+			texture_row_visible(iter, id, p);
+		} else if (type == TYPE_SHADER) {
+			gtk_tree_model_iter_parent(model, &parent, iter);
+			gtk_tree_model_get(model, &parent, COLUMN_ID, &parent_id, -1);
+			shader_row_visible(iter, parent_id, id, p);
+		}
+	}
+
+	if (type == TYPE_TEXTURE)
+		thumb_row(iter, id, p);
+}
+
+static gboolean visible_update(gpointer data)
+{
+	struct program *p = (struct program *)data;
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
+	GtkTreePath *start;
+	GtkTreePath *end;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	gboolean more;
+	unsigned i;
+
+	p->main.visible_timer = 0;
+
+	if (!p->rbug.con)
+		return FALSE;
+
+	if (!gtk_tree_view_get_visible_range(p->main.treeview, &start, &end))
+		return FALSE;
+
+	more = gtk_tree_model_get_iter(model, &iter, start);
+
+	for (i = 0; more && i < MAIN_VISIBLE_ROWS; i++) {
+		visible_row(&iter, p);
+
+		path = gtk_tree_model_get_path(model, &iter);
+		more = gtk_tree_path_compare(path, end) < 0;
+		gtk_tree_path_free(path);
+
+		if (more)
+			more = visible_next(model, &iter, p->main.treeview);
+	}
+
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
+
+	return FALSE;
+}
+
+static void visible_scrolled(GtkAdjustment *adjustment, gpointer data)
+{
+	(void)adjustment;
+
+	main_visible_schedule((struct program *)data);
+}
+
+static void visible_expanded(GtkTreeView *view, GtkTreeIter *iter,
+                             GtkTreePath *path, gpointer data)
+{
+	(void)view;
+	(void)iter;
+	(void)path;
+
+	main_visible_schedule((struct program *)data);
+}
+
+static void row_inserted(GtkTreeModel *model, GtkTreePath *path,
+                         GtkTreeIter *iter, gpointer data)
+{
+	(void)model;
+	(void)path;
+	(void)iter;
+
+	main_visible_schedule((struct program *)data);
+}
+
 static void refresh(GtkWidget *widget, gpointer data)
 {
 	struct program *p = (struct program *)data;
-	GtkTreeStore *store = p->main.treestore;
+	struct store *store = p->main.store;
 	(void)widget;
 
 	if (p->selected.id != 0) {
@@ -217,14 +424,11 @@ static void refresh(GtkWidget *widget, gpointer data)
 		return;
 	}
 
-	gtk_tree_store_clear(p->main.treestore);
+	cache_invalidate(p);
+	store_clear(store);
 
-	gtk_tree_store_insert_with_values(store, &p->main.top, NULL, -1,
-	                                  COLUMN_ID, (guint64)0,
-	                                  COLUMN_TYPE, TYPE_SCREEN,
-	                                  COLUMN_TYPENAME, "screen",
-	                                  COLUMN_PIXBUF, icon_get("screen", p),
-	                                  -1);
+	store_append(store, &p->main.top, NULL, 0, TYPE_SCREEN);
+	store_set_pixbuf(store, &p->main.top, icon_get("screen", p));
 
 	/* contexts */
 	context_list(store, &p->main.top, p);
@@ -236,6 +440,47 @@ static void refresh(GtkWidget *widget, gpointer data)
 	gtk_tree_view_expand_all(p->main.treeview);
 }
 
+/*
+ * The text cells are filled in straight from the store when drawn,
+ * without going through a GValue per cell.
+ */
+
+static void cell_id(GtkTreeViewColumn *col, GtkCellRenderer *renderer,
+                    GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	char text[32];
+	(void)col;
+	(void)data;
+
+	snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT,
+	         store_id((struct store *)model, iter));
+
+	g_object_set(G_OBJECT(renderer), "text", text, NULL);
+}
+
+static void cell_type(GtkTreeViewColumn *col, GtkCellRenderer *renderer,
+                      GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	(void)col;
+	(void)data;
+
+	g_object_set(G_OBJECT(renderer), "text",
+	             store_typename((struct store *)model, iter), NULL);
+}
+
+static void cell_info(GtkTreeViewColumn *col, GtkCellRenderer *renderer,
+                      GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	char text[128];
+	(void)col;
+	(void)data;
+
+	if (store_info_short((struct store *)model, iter, text, sizeof(text)))
+		g_object_set(G_OBJECT(renderer), "text", text, NULL);
+	else
+		g_object_set(G_OBJECT(renderer), "text", NULL, NULL);
+}
+
 static void setup_cols(GtkBuilder *builder, GtkTreeView *view, struct program *p)
 {
 	GtkTreeViewColumn *col;
@@ -247,13 +492,13 @@ static void setup_cols(GtkBuilder *builder, GtkTreeView *view, struct program *p
 	col = GTK_TREE_VIEW_COLUMN(gtk_builder_get_object(builder, "col_id"));
 	renderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(col, renderer, TRUE);
-	gtk_tree_view_column_add_attribute(col, renderer, "text", COLUMN_ID);
+	gtk_tree_view_column_set_cell_data_func(col, renderer, cell_id, NULL, NULL);
 
 	/* column type */
 	col = GTK_TREE_VIEW_COLUMN(gtk_builder_get_object(builder, "col_type"));
 	renderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(col, renderer, TRUE);
-	gtk_tree_view_column_add_attribute(col, renderer, "text", COLUMN_TYPENAME);
+	gtk_tree_view_column_set_cell_data_func(col, renderer, cell_type, NULL, NULL);
 
 	/* column icon */
 	col = GTK_TREE_VIEW_COLUMN(gtk_builder_get_object(builder, "col_icon"));
@@ -265,7 +510,7 @@ static void setup_cols(GtkBuilder *builder, GtkTreeView *view, struct program *p
 	col = GTK_TREE_VIEW_COLUMN(gtk_builder_get_object(builder, "col_info"));
 	renderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(col, renderer, TRUE);
-	gtk_tree_view_column_add_attribute(col, renderer, "text", COLUMN_INFO_SHORT);
+	gtk_tree_view_column_set_cell_data_func(col, renderer, cell_info, NULL, NULL);
 
 	g_object_set(G_OBJECT(renderer), "xalign", (gfloat)0.0f, NULL);
 }
@@ -347,7 +592,7 @@ static gboolean find_foreach(GtkTreeModel *model,
 
 gboolean main_find_id(guint64 id, GtkTreeIter *out, struct program *p)
 {
-	GtkTreeModel *model = GTK_TREE_MODEL(p->main.treestore);
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
 	struct find_struct find;
 
 	find.out = out;
@@ -361,7 +606,7 @@ gboolean main_find_id(guint64 id, GtkTreeIter *out, struct program *p)
 
 void main_set_viewed(GtkTreeIter *iter, gboolean force_update, struct program *p)
 {
-	GtkTreeModel *model = GTK_TREE_MODEL(p->main.treestore);
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
 	GtkTreeIter parent;
 	enum types old_type;
 	uint64_t old_id;
@@ -441,12 +686,17 @@ void main_window_create(struct program *p)
 	GtkWidget *context_view;
 	GtkWidget *textview_scrolled;
 	GtkTreeView *treeview;
-	GtkTreeStore *treestore;
+	struct store *store;
 	GtkStatusbar *statusbar;
 	GtkSpinButton *layer;
+	GtkSpinButton *level;
 
 	GObject *tool_quit;
 	GObject *tool_refresh;
+	GObject *tool_stats;
+	GObject *tool_thumbnails;
+	GtkWidget *stats_panel;
+	GtkTextView *stats_view;
 
 	GObject *tool_break_before;
 	GObject *tool_break_after;
@@ -474,13 +724,13 @@ void main_window_create(struct program *p)
 	window = GTK_WIDGET(gtk_builder_get_object(builder, "window"));
 	textview = GTK_TEXT_VIEW(gtk_builder_get_object(builder, "textview"));
 	treeview = GTK_TREE_VIEW(gtk_builder_get_object(builder, "treeview"));
-	treestore = GTK_TREE_STORE(gtk_builder_get_object(builder, "treestore"));
 	selection = G_OBJECT(gtk_tree_view_get_selection(treeview));
 	statusbar = GTK_STATUSBAR(gtk_builder_get_object(builder, "statusbar"));
 	texture_view = GTK_WIDGET(gtk_builder_get_object(builder, "texture_view"));
 	context_view = GTK_WIDGET(gtk_builder_get_object(builder, "context_view"));
 	textview_scrolled = GTK_WIDGET(gtk_builder_get_object(builder, "textview_scrolled"));
 	layer = GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "layer"));
+	level = GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "level"));
 
 	tool_quit = gtk_builder_get_object(builder, "tool_quit");
 	tool_refresh = gtk_builder_get_object(builder, "tool_refresh");
@@ -502,11 +752,23 @@ void main_window_create(struct program *p)
 	tool_save = gtk_builder_get_object(builder, "tool_save");
 	tool_revert = gtk_builder_get_object(builder, "tool_revert");
 
+	tool_stats = gtk_builder_get_object(builder, "tool_stats");
+	stats_panel = GTK_WIDGET(gtk_builder_get_object(builder, "stats_scrolled"));
+	stats_view = GTK_TEXT_VIEW(gtk_builder_get_object(builder, "stats_view"));
+	tool_thumbnails = gtk_builder_get_object(builder, "tool_thumbnails");
+
+	store = store_new();
+	gtk_tree_view_set_model(treeview, GTK_TREE_MODEL(store));
+
 	setup_cols(builder, treeview, p);
 
 	/* manualy set up signals */
 	g_signal_connect(selection, "changed", G_CALLBACK(changed), p);
-	g_signal_connect(treestore, "row-changed", G_CALLBACK(row_changed), p);
+	g_signal_connect(store, "row-changed", G_CALLBACK(row_changed), p);
+	g_signal_connect(store, "row-inserted", G_CALLBACK(row_inserted), p);
+	g_signal_connect(treeview, "row-expanded", G_CALLBACK(visible_expanded), p);
+	g_signal_connect(gtk_tree_view_get_vadjustment(treeview), "value-changed",
+	                 G_CALLBACK(visible_scrolled), p);
 	g_signal_connect(tool_quit, "clicked", G_CALLBACK(destroy), p);
 	g_signal_connect(tool_refresh, "clicked", G_CALLBACK(refresh), p);
 	g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(destroy), p);
@@ -549,12 +811,13 @@ void main_window_create(struct program *p)
 	p->main.window = window;
 	p->main.textview = textview;
 	p->main.treeview = treeview;
-	p->main.treestore = treestore;
+	p->main.store = store;
 	p->main.statusbar = statusbar;
 	p->main.texture_view = texture_view;
 	p->main.context_view = context_view;
 	p->main.textview_scrolled = textview_scrolled;
 	p->main.layer = layer;
+	p->main.level = level;
 
 	p->tool.break_before = GTK_WIDGET(tool_break_before);
 	p->tool.break_after = GTK_WIDGET(tool_break_after);
@@ -572,8 +835,11 @@ void main_window_create(struct program *p)
 	p->tool.enable = GTK_WIDGET(tool_enable);
 	p->tool.save = GTK_WIDGET(tool_save);
 	p->tool.revert = GTK_WIDGET(tool_revert);
+	p->tool.refresh = GTK_WIDGET(tool_refresh);
 
 	draw_setup(draw, p);
+	stats_setup(GTK_WIDGET(tool_stats), stats_panel, stats_view, p);
+	thumb_setup(GTK_WIDGET(tool_thumbnails), p);
 
 	gtk_widget_hide(p->tool.back);
 	gtk_widget_hide(p->tool.forward);
@@ -597,16 +863,37 @@ void main_window_create(struct program *p)
 
 	/* do a refresh */
 	refresh(GTK_WIDGET(tool_refresh), p);
+
+	if (p->bench.enabled)
+		bench_start(p);
 }
 
 void main_quit(struct program *p)
 {
+	bench_stop(p);
+	ask_stop(p);
+
 	if (p->rbug.con) {
+		net_stop(p);
+		replay_stop(p);
 		rbug_disconnect(p->rbug.con);
+		p->rbug.con = NULL;
+	}
+
+	net_fini(p);
+
+	/* already gone if the connection was lost */
+	if (p->rbug.channel) {
 		g_io_channel_unref(p->rbug.channel);
 		g_source_remove(p->rbug.event);
+		p->rbug.channel = NULL;
+	}
+
+	if (p->rbug.hash_event) {
 		g_hash_table_unref(p->rbug.hash_event);
-		g_hash_table_unref(p->rbug.hash_reply);
+		g_hash_table_unref(p->rbug.shared);
+		g_free(p->rbug.ring);
+		p->rbug.hash_event = NULL;
 	}
 
 	g_free(p->ask.host);
@@ -614,6 +901,237 @@ void main_quit(struct program *p)
 	gtk_main_quit();
 }
 
+/*
+ * Buttons that send straight on the connection instead of through
+ * rbug_queue, those sends would be lost while it is down.
+ */
+static void main_set_connected(gboolean connected, struct program *p)
+{
+	gtk_widget_set_sensitive(p->tool.break_before, connected);
+	gtk_widget_set_sensitive(p->tool.break_after, connected);
+	gtk_widget_set_sensitive(p->tool.step, connected);
+	gtk_widget_set_sensitive(p->tool.flush, connected);
+	gtk_widget_set_sensitive(p->tool.enable, connected);
+	gtk_widget_set_sensitive(p->tool.disable, connected);
+	gtk_widget_set_sensitive(p->tool.save, connected);
+	gtk_widget_set_sensitive(p->tool.revert, connected);
+}
+
+/**
+ * The connection dropped and is being reestablished,
+ * see rbug_lost. Everything shown is kept meanwhile.
+ */
+void main_disconnected(struct program *p)
+{
+	guint id = gtk_statusbar_get_context_id(p->main.statusbar, "connection");
+
+	gtk_statusbar_push(p->main.statusbar, id, "Connection lost, reconnecting...");
+	main_set_connected(FALSE, p);
+
+	ask_reconnect(p);
+}
+
+/**
+ * Connected again, list the objects again but only add and remove
+ * the rows of objects that were created or destroyed. Everything
+ * else shown is fetched again.
+ */
+void main_reconnected(struct program *p)
+{
+	guint id = gtk_statusbar_get_context_id(p->main.statusbar, "connection");
+
+	gtk_statusbar_pop(p->main.statusbar, id);
+	main_set_connected(TRUE, p);
+
+	/* anything may have changed meanwhile, kept rows are asked again */
+	cache_invalidate(p);
+	context_reconnected(p);
+	store_reset_state(p->main.store);
+
+	if (p->viewed.type == TYPE_TEXTURE)
+		texture_refresh(p);
+
+	context_list(p->main.store, &p->main.top, p);
+	texture_list(p->main.store, &p->main.top, p);
+}
+
+/**
+ * What the view shows, kept while the model is taken off it.
+ */
+struct main_batch
+{
+	GSList *expanded;
+	GtkTreePath *top;
+	GtkTreeIter selected;
+	gboolean has_selected;
+};
+
+static void batch_expanded(GtkTreeView *view, GtkTreePath *path, gpointer data)
+{
+	GSList **expanded = (GSList **)data;
+	(void)view;
+
+	*expanded = g_slist_prepend(*expanded, gtk_tree_path_copy(path));
+}
+
+static void batch_begin(struct main_batch *batch, struct program *p)
+{
+	GtkTreeSelection *selection = gtk_tree_view_get_selection(p->main.treeview);
+	GtkTreePath *end;
+
+	memset(batch, 0, sizeof(*batch));
+
+	gtk_tree_view_map_expanded_rows(p->main.treeview, batch_expanded, &batch->expanded);
+	if (gtk_tree_view_get_visible_range(p->main.treeview, &batch->top, &end))
+		gtk_tree_path_free(end);
+	batch->has_selected = gtk_tree_selection_get_selected(selection, NULL, &batch->selected);
+
+	/* the row is only unselected for as long as the model is away */
+	g_signal_handlers_block_by_func(selection, changed, p);
+
+	gtk_tree_view_set_model(p->main.treeview, NULL);
+	store_freeze(p->main.store);
+}
+
+static void batch_end(struct main_batch *batch, struct program *p)
+{
+	GtkTreeSelection *selection = gtk_tree_view_get_selection(p->main.treeview);
+	GSList *l;
+
+	store_thaw(p->main.store);
+	gtk_tree_view_set_model(p->main.treeview, GTK_TREE_MODEL(p->main.store));
+
+	/* parents were mapped first, a row is only expanded if they are */
+	batch->expanded = g_slist_reverse(batch->expanded);
+	for (l = batch->expanded; l; l = l->next) {
+		gtk_tree_view_expand_row(p->main.treeview, l->data, FALSE);
+		gtk_tree_path_free(l->data);
+	}
+	g_slist_free(batch->expanded);
+
+	if (batch->has_selected)
+		gtk_tree_selection_select_iter(selection, &batch->selected);
+
+	g_signal_handlers_unblock_by_func(selection, changed, p);
+
+	if (batch->top) {
+		gtk_tree_view_scroll_to_cell(p->main.treeview, batch->top, NULL, TRUE, 0.0f, 0.0f);
+		gtk_tree_path_free(batch->top);
+	}
+
+	main_visible_schedule(p);
+}
+
+/**
+ * Look at the rows on screen in a little while, fetching the info of
+ * those the list did not tell us about and their thumbnails.
+ */
+void main_visible_schedule(struct program *p)
+{
+	if (p->main.visible_timer)
+		return;
+
+	p->main.visible_timer = g_timeout_add(MAIN_VISIBLE_DELAY, visible_update, p);
+}
+
+/**
+ * Bring the children of parent of the given type in line with a list
+ * reply: rows whose id is not in ids are removed, the rest are returned
+ * in a table from id to struct main_child for the caller to look up
+ * which ids are new. The caller destroys the table.
+ */
+GHashTable * main_sync_children(GtkTreeIter *parent, enum types type,
+                                const guint64 *ids, unsigned num,
+                                struct program *p)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
+	struct main_child *child;
+	GHashTable *listed;
+	GHashTable *rows;
+	GArray *removed;
+	GtkTreeIter iter;
+	gboolean more;
+	guint64 id;
+	gint t;
+	unsigned i;
+
+	listed = g_hash_table_new(g_int64_hash, g_int64_equal);
+	rows = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+	removed = g_array_new(FALSE, FALSE, sizeof(GtkTreeIter));
+
+	for (i = 0; i < num; i++)
+		g_hash_table_insert(listed, (gpointer)&ids[i], (gpointer)&ids[i]);
+
+	more = gtk_tree_model_iter_children(model, &iter, parent);
+	while (more) {
+		gtk_tree_model_get(model, &iter, COLUMN_ID, &id, COLUMN_TYPE, &t, -1);
+
+		if (t != (gint)type) {
+			more = gtk_tree_model_iter_next(model, &iter);
+			continue;
+		}
+
+		/* destroyed since it was listed */
+		if (!g_hash_table_lookup(listed, &id)) {
+			if (p->viewed.id == id && p->viewed.type == type)
+				main_set_viewed(NULL, FALSE, p);
+
+			g_array_append_val(removed, iter);
+			more = gtk_tree_model_iter_next(model, &iter);
+			continue;
+		}
+
+		child = g_malloc(sizeof(*child));
+		child->id = id;
+		child->iter = iter;
+		g_hash_table_insert(rows, &child->id, child);
+
+		more = gtk_tree_model_iter_next(model, &iter);
+	}
+
+	store_remove_rows(p->main.store, parent, (GtkTreeIter *)removed->data, removed->len);
+
+	g_array_free(removed, TRUE);
+	g_hash_table_destroy(listed);
+
+	return rows;
+}
+
+/**
+ * Append the ids that are not in rows, a table returned from
+ * main_sync_children, as children of parent and add them to it.
+ *
+ * For more than MAIN_BATCH rows the model is taken off the view while
+ * they are added, which then lays out the whole tree once instead of
+ * handling a row-inserted per row.
+ */
+void main_add_children(GtkTreeIter *parent, enum types type,
+                       const guint64 *ids, unsigned num,
+                       GHashTable *rows, struct program *p)
+{
+	struct main_child *child;
+	struct main_batch batch;
+	gboolean batched;
+	unsigned i;
+
+	batched = num - MIN(num, g_hash_table_size(rows)) >= MAIN_BATCH;
+	if (batched)
+		batch_begin(&batch, p);
+
+	for (i = 0; i < num; i++) {
+		if (g_hash_table_lookup(rows, &ids[i]))
+			continue;
+
+		child = g_malloc(sizeof(*child));
+		child->id = ids[i];
+		store_append(p->main.store, &child->iter, parent, ids[i], type);
+		g_hash_table_insert(rows, &child->id, child);
+	}
+
+	if (batched)
+		batch_end(&batch, p);
+}
+
 void icon_add(const char *filename, const char *name, struct program *p)
 {
 	GdkPixbuf *icon = gdk_pixbuf_new_from_file(filename, NULL);
@@ -0,0 +1,489 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The network thread owns the socket to the debugged application.
+ *
+ * The rbug connection used by the rest of the program is one end of a
+ * socketpair, the thread forwards whatever is written to it out on the
+ * socket. Incoming messages are read and demarshaled on the thread and
+ * handed to the main loop through a single producer single consumer
+ * fifo, the main loop is woken up by a byte written to a pipe.
+ *
+ * With --record everything sent and received is also written to a
+ * capture file: NET_RECORD_MAGIC followed by a struct net_record and
+ * its bytes for each forwarded chunk or received message. A reconnect
+ * adds an empty NET_RECORD_CONNECTED record, serials start over there.
+ */
+
+#include "program.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "rbug/rbug_internal.h"
+#include "util/u_memory.h"
+#include "util/u_network.h"
+
+/* fifo indices run over twice the size so full and empty differ */
+#define NET_INDEX_MASK (NET_FIFO_SIZE * 2 - 1)
+
+/* how much is forwarded from the connection to the socket at once */
+#define NET_CHUNK (64 * 1024)
+
+/* FNV-1a over message bodies, see net_frame */
+#define NET_HASH_BASIS 14695981039346656037ull
+#define NET_HASH_PRIME 1099511628211ull
+
+/* partially received message */
+struct net_rx
+{
+	struct rbug_proto_header header;
+	size_t header_read;
+
+	uint8_t *data;
+	size_t length;
+	size_t read;
+};
+
+/* chunk forwarded to the connection, [start, end) is still to be sent */
+struct net_tx
+{
+	struct net_frame frame;
+
+	uint8_t buf[NET_CHUNK];
+	size_t start;
+	size_t end;
+};
+
+
+/*
+ * Network thread
+ */
+
+
+static gboolean net_push(struct rbug_header *header, struct program *p)
+{
+	gint tail = p->net.tail;
+
+	/* main loop is behind, wait for it to catch up */
+	while (((tail - g_atomic_int_get(&p->net.head)) & NET_INDEX_MASK) == NET_FIFO_SIZE) {
+		if (g_atomic_int_get(&p->net.stop))
+			return FALSE;
+
+		g_usleep(1000);
+	}
+
+	p->net.fifo[tail & (NET_FIFO_SIZE - 1)] = header;
+	g_atomic_int_set(&p->net.tail, (tail + 1) & NET_INDEX_MASK);
+
+	net_wake(p);
+
+	return TRUE;
+}
+
+static void net_frame_sent(struct rbug_proto_header *header, void *data)
+{
+	stats_sent(header->opcode, (size_t)header->length * 4, (struct program *)data);
+}
+
+static void net_record(enum net_record_dir dir, const void *data, size_t size,
+                       struct program *p)
+{
+	struct net_record rec;
+
+	if (!p->net.record)
+		return;
+
+	rec.time = g_get_monotonic_time() - p->net.start;
+	rec.dir = dir;
+	rec.size = size;
+
+	if (fwrite(&rec, sizeof(rec), 1, p->net.record) != 1 ||
+	    fwrite(data, 1, size, p->net.record) != size) {
+		g_print("failed to write capture, recording stopped\n");
+		fclose(p->net.record);
+		p->net.record = NULL;
+	}
+}
+
+static gboolean net_would_block(int ret)
+{
+	return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+/**
+ * Read what is available of the current message.
+ *
+ * Never blocks, a large message is put together over several calls
+ * so outgoing requests keep flowing while it arrives.
+ */
+static gboolean net_recv(struct net_rx *rx, struct program *p)
+{
+	struct rbug_header *header;
+	int ret;
+
+	if (rx->header_read < sizeof(rx->header)) {
+		ret = recv(p->rbug.socket,
+		           (uint8_t *)&rx->header + rx->header_read,
+		           sizeof(rx->header) - rx->header_read,
+		           MSG_DONTWAIT);
+		if (ret <= 0)
+			return net_would_block(ret);
+
+		rx->header_read += ret;
+		if (rx->header_read < sizeof(rx->header))
+			return TRUE;
+
+		rx->length = (size_t)rx->header.length * 4;
+		if (rx->length < sizeof(rx->header)) {
+			g_print("bad message length %u\n", rx->header.length);
+			return FALSE;
+		}
+
+		rx->data = MALLOC(rx->length);
+		if (!rx->data)
+			return FALSE;
+
+		memcpy(rx->data, &rx->header, sizeof(rx->header));
+		rx->read = sizeof(rx->header);
+	}
+
+	if (rx->read < rx->length) {
+		ret = recv(p->rbug.socket,
+		           rx->data + rx->read,
+		           rx->length - rx->read,
+		           MSG_DONTWAIT);
+		if (ret <= 0)
+			return net_would_block(ret);
+
+		rx->read += ret;
+		if (rx->read < rx->length)
+			return TRUE;
+	}
+
+	stats_received(rx->header.opcode, rx->length, p);
+	net_record(NET_RECORD_RECEIVED, rx->data, rx->length, p);
+
+	header = rbug_demarshal((struct rbug_proto_header *)rx->data);
+	if (!header) {
+		g_print("failed to demarshal message with op: %i\n", (int)rx->header.opcode);
+		FREE(rx->data);
+	} else if (!net_push(header, p)) {
+		rbug_free_header(header);
+	}
+
+	rx->data = NULL;
+	rx->header_read = 0;
+	rx->read = 0;
+
+	return TRUE;
+}
+
+/**
+ * Send what is left of the current chunk, as much as the connection
+ * takes without blocking. The rest waits for POLLOUT, meanwhile
+ * incoming messages are still read so the other end never waits on
+ * us to read while we wait on it.
+ */
+static gboolean net_flush(struct net_tx *tx, struct program *p)
+{
+	ssize_t sent;
+
+	while (tx->start < tx->end) {
+		sent = send(p->rbug.socket, tx->buf + tx->start, tx->end - tx->start,
+		            MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0)
+			return net_would_block(sent);
+
+		tx->start += sent;
+	}
+
+	return TRUE;
+}
+
+static gboolean net_send(struct net_tx *tx, struct program *p)
+{
+	ssize_t ret;
+
+	ret = read(p->net.pair[1], tx->buf, sizeof(tx->buf));
+	if (ret <= 0)
+		return net_would_block(ret);
+
+	net_frame(&tx->frame, tx->buf, ret, net_frame_sent, p);
+	net_record(NET_RECORD_SENT, tx->buf, ret, p);
+
+	tx->start = 0;
+	tx->end = ret;
+
+	return net_flush(tx, p);
+}
+
+static gpointer net_thread(gpointer data)
+{
+	struct program *p = (struct program *)data;
+	struct pollfd fds[2];
+	struct net_tx *tx;
+	struct net_rx rx;
+	gboolean pending;
+
+	tx = g_malloc(sizeof(*tx));
+	memset(tx, 0, sizeof(*tx));
+	memset(&rx, 0, sizeof(rx));
+
+	while (!g_atomic_int_get(&p->net.stop)) {
+		/* nothing more is taken from the main loop until this is out */
+		pending = tx->start < tx->end;
+
+		fds[0].fd = p->rbug.socket;
+		fds[0].events = POLLIN | (pending ? POLLOUT : 0);
+		fds[0].revents = 0;
+		fds[1].fd = p->net.pair[1];
+		fds[1].events = pending ? 0 : POLLIN;
+		fds[1].revents = 0;
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if ((fds[0].revents | fds[1].revents) & POLLNVAL)
+			break;
+
+		if (fds[0].revents & POLLOUT)
+			if (!net_flush(tx, p))
+				break;
+
+		if (!pending && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+			if (!net_send(tx, p))
+				break;
+
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+			if (!net_recv(&rx, p))
+				break;
+	}
+
+	FREE(rx.data);
+	g_free(tx);
+
+	g_atomic_int_set(&p->net.done, 1);
+	net_wake(p);
+
+	return NULL;
+}
+
+
+/*
+ * Exported
+ */
+
+
+/**
+ * Follow the message framing of a byte stream, done is called
+ * each time the last byte of a message has gone past. Until then
+ * f->id and f->hash are filled in from the body of the message.
+ */
+void net_frame(struct net_frame *f, const uint8_t *buf, size_t len,
+               void (*done)(struct rbug_proto_header *, void *), void *data)
+{
+	size_t length;
+	size_t off;
+	size_t n, i;
+
+	while (len) {
+		if (f->header_read < sizeof(f->header)) {
+			n = MIN(len, sizeof(f->header) - f->header_read);
+			memcpy((uint8_t *)&f->header + f->header_read, buf, n);
+			f->header_read += n;
+
+			if (f->header_read == sizeof(f->header)) {
+				length = (size_t)f->header.length * 4;
+				f->left = length > sizeof(f->header) ? length - sizeof(f->header) : 0;
+				f->body = f->left;
+				f->id = 0;
+				f->hash = NET_HASH_BASIS;
+			}
+		} else {
+			n = MIN(len, f->left);
+			off = f->body - f->left;
+
+			if (off < sizeof(f->id))
+				memcpy((uint8_t *)&f->id + off, buf, MIN(n, sizeof(f->id) - off));
+			for (i = 0; i < n; i++)
+				f->hash = (f->hash ^ buf[i]) * NET_HASH_PRIME;
+
+			f->left -= n;
+		}
+
+		buf += n;
+		len -= n;
+
+		if (f->header_read == sizeof(f->header) && !f->left) {
+			done(&f->header, data);
+			f->header_read = 0;
+		}
+	}
+}
+
+gboolean net_start(struct program *p)
+{
+	/* opened once and kept across reconnects, see net_fini */
+	if (p->net.record_file && !p->net.start) {
+		p->net.record = fopen(p->net.record_file, "wb");
+		if (!p->net.record) {
+			g_print("failed to open capture file %s\n", p->net.record_file);
+			return FALSE;
+		}
+
+		fwrite(NET_RECORD_MAGIC, 1, strlen(NET_RECORD_MAGIC), p->net.record);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, p->net.pair) < 0)
+		return FALSE;
+
+	if (pipe(p->net.wake) < 0) {
+		close(p->net.pair[0]);
+		close(p->net.pair[1]);
+		return FALSE;
+	}
+
+	fcntl(p->net.wake[0], F_SETFL, O_NONBLOCK);
+
+	/* the thread never blocks on it, see net_flush */
+	fcntl(p->rbug.socket, F_SETFL, fcntl(p->rbug.socket, F_GETFL) | O_NONBLOCK);
+
+	p->net.head = 0;
+	p->net.tail = 0;
+	p->net.wake_pending = 0;
+	p->net.stop = 0;
+	p->net.done = 0;
+
+	/* capture times keep counting from the first connection */
+	if (!p->net.start)
+		p->net.start = g_get_monotonic_time();
+	else
+		net_record(NET_RECORD_CONNECTED, "", 0, p);
+
+	p->rbug.con = rbug_from_socket(p->net.pair[0]);
+	p->net.thread = g_thread_new("rbug-net", net_thread, p);
+
+	return TRUE;
+}
+
+/**
+ * Stop the thread and close the socket, the connection
+ * itself is still left for rbug_disconnect to free.
+ */
+void net_stop(struct program *p)
+{
+	struct rbug_header *header;
+
+	if (!p->net.thread)
+		return;
+
+	g_atomic_int_set(&p->net.stop, 1);
+
+	/* kicks the thread out of poll and any send */
+	shutdown(p->rbug.socket, SHUT_RDWR);
+	g_thread_join(p->net.thread);
+	p->net.thread = NULL;
+
+	while ((header = net_pop(p)))
+		rbug_free_header(header);
+
+	u_socket_close(p->rbug.socket);
+	close(p->net.pair[1]);
+	close(p->net.wake[0]);
+	close(p->net.wake[1]);
+}
+
+/**
+ * Close the capture, once no more connections will be made.
+ */
+void net_fini(struct program *p)
+{
+	if (p->net.record)
+		fclose(p->net.record);
+	p->net.record = NULL;
+}
+
+/**
+ * Get the next received message, NULL if there is none.
+ *
+ * Only to be called from the main loop.
+ */
+struct rbug_header * net_pop(struct program *p)
+{
+	struct rbug_header *header;
+	gint head = p->net.head;
+
+	if (head == g_atomic_int_get(&p->net.tail))
+		return NULL;
+
+	header = p->net.fifo[head & (NET_FIFO_SIZE - 1)];
+	g_atomic_int_set(&p->net.head, (head + 1) & NET_INDEX_MASK);
+
+	return header;
+}
+
+/**
+ * Has the thread gone away and every message been popped.
+ */
+gboolean net_closed(struct program *p)
+{
+	if (!g_atomic_int_get(&p->net.done))
+		return FALSE;
+
+	return p->net.head == g_atomic_int_get(&p->net.tail);
+}
+
+/**
+ * Make the main loop call rbug_event, safe from any thread.
+ */
+void net_wake(struct program *p)
+{
+	char c = 0;
+
+	if (!g_atomic_int_compare_and_exchange(&p->net.wake_pending, 0, 1))
+		return;
+
+	if (write(p->net.wake[1], &c, 1) != 1)
+		g_print("failed to wake up main loop\n");
+}
+
+/**
+ * Called by the main loop when woken up.
+ */
+void net_ack(struct program *p)
+{
+	char buf[16];
+
+	while (read(p->net.wake[0], buf, sizeof(buf)) > 0);
+
+	g_atomic_int_set(&p->net.wake_pending, 0);
+}
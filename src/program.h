@@ -25,6 +25,8 @@
 #ifndef _RBUG_GUI_PROGRAM_H_
 #define _RBUG_GUI_PROGRAM_H_
 
+#include <stdio.h>
+
 #include <gtk/gtk.h>
 #include <gtk/gtkgl.h>
 
@@ -33,10 +35,113 @@
 struct program;
 struct texture_action_read;
 struct shader_action_info;
+struct stats_op;
+struct store;
 
 struct rbug_event
 {
 	gboolean (*func)(struct rbug_event *, struct rbug_header *, struct program *);
+
+	/* sends the request and returns its opcode, see rbug_queue */
+	int16_t (*send)(struct rbug_event *, uint32_t *serial, struct program *);
+};
+
+enum rbug_lane {
+	RBUG_LANE_INTERACTIVE = 0, /* the currently viewed object */
+	RBUG_LANE_BACKGROUND,      /* tree metadata */
+	RBUG_LANE_NUM,
+};
+
+/* received messages the network thread can queue up, power of two */
+#define NET_FIFO_SIZE 1024
+
+/* capture file, see --record and --replay */
+#define NET_RECORD_MAGIC "RBUGCAP1"
+
+enum net_record_dir {
+	NET_RECORD_SENT = 0, /* by us */
+	NET_RECORD_RECEIVED,
+	NET_RECORD_CONNECTED, /* again, after the connection was lost */
+};
+
+struct net_record
+{
+	guint64 time; /* us since the connection was made */
+	guint32 dir;
+	guint32 size; /* bytes following */
+};
+
+/**
+ * Message boundaries in a byte stream, see net_frame.
+ */
+struct net_frame
+{
+	struct rbug_proto_header header;
+	size_t header_read;
+	size_t left;
+
+	/* of the body, the first 8 bytes are the object most requests are about */
+	size_t body;
+	guint64 id;
+	guint64 hash;
+};
+
+/* default number of requests in flight per lane */
+#define RBUG_WINDOW_INTERACTIVE 4
+#define RBUG_WINDOW_BACKGROUND 16
+
+/* default texture reads a second with Auto, see --auto-rate */
+#define TEXTURE_AUTO_RATE 10
+
+/**
+ * A row already in the tree, see main_sync_children.
+ */
+struct main_child
+{
+	guint64 id;
+	GtkTreeIter iter;
+};
+
+/**
+ * An uploaded texture, see src/cache.c.
+ */
+struct cache_texture
+{
+	rbug_texture_t id;
+	unsigned level;
+	unsigned layer;
+	guint tile;
+
+	/* GL texture name, internal format is 0 until it has storage */
+	guint tex;
+	gint internal_format;
+	/* pipe format uploaded and the hashes of its tiles if known */
+	unsigned format;
+	guint64 *hashes;
+	unsigned width;
+	unsigned height;
+	unsigned depth;
+	unsigned levels;
+	size_t size;
+
+	guint generation;
+	GList link;
+};
+
+/**
+ * A request waiting for its reply, see rbug_queue.
+ */
+struct rbug_reply
+{
+	struct rbug_event *e;
+
+	/* when the request was sent, g_get_monotonic_time */
+	gint64 sent;
+	uint32_t serial;
+	int16_t op;
+
+	/* RBUG_LANE_NUM if not sent through rbug_queue */
+	enum rbug_lane lane;
 };
 
 enum columns {
@@ -46,6 +151,18 @@ enum columns {
 	COLUMN_PIXBUF,
 	COLUMN_INFO_SHORT, /* used for info feild */
 	COLUMN_INFO_LONG,  /* used for statusbar */
+	COLUMN_INFO_STATE, /* enum info_state */
+	COLUMN_NUM,
+};
+
+/**
+ * Rows are listed without their info, it is fetched once they are
+ * scrolled into view, see main_visible_schedule.
+ */
+enum info_state {
+	INFO_NONE = 0,
+	INFO_PENDING,
+	INFO_DONE,
 };
 
 enum types {
@@ -98,12 +215,26 @@ struct program
 
 		char *host;
 		uint16_t port;
+
+		/* in progress connect, see ask_connect */
+		gboolean connecting;
+		GCancellable *cancel;
+		GList *probes;
+		guint timeout;
+
+		/* reconnecting after the connection dropped, in ms */
+		guint backoff;
+		guint retry;
 	} ask;
 
 	struct {
 		uint32_t width;
 		uint32_t height;
 		GdkGLConfig *config;
+
+		/* last pointer position while dragging */
+		double drag_x;
+		double drag_y;
 	} draw;
 
 	struct {
@@ -113,8 +244,9 @@ struct program
 		GtkTextView *textview;
 		GtkWidget *textview_scrolled;
 		GtkTreeView *treeview;
-		GtkTreeStore *treestore;
+		struct store *store;
 		GtkSpinButton *layer;
+		GtkSpinButton *level;
 		GtkDrawingArea *draw;
 		GtkStatusbar *statusbar;
 
@@ -122,6 +254,9 @@ struct program
 		guint sb_id;
 
 		GtkTreeIter top;
+
+		/* see main_visible_schedule */
+		guint visible_timer;
 	} main;
 
 	struct {
@@ -155,6 +290,10 @@ struct program
 		GtkWidget *disable;
 		GtkWidget *save;
 		GtkWidget *revert;
+
+		GtkWidget *stats;
+		GtkWidget *thumbnails;
+		GtkWidget *refresh;
 	} tool;
 
 	struct {
@@ -166,6 +305,12 @@ struct program
 		enum ctx_view_id view_id;
 
 		struct rbug_event blocked_event;
+		/* number of draw blocked events seen */
+		guint blocked_count;
+
+		/* contexts known to be blocked on a draw, out of num */
+		GHashTable *blocked;
+		guint num;
 	} context;
 
 	struct {
@@ -180,25 +325,184 @@ struct program
 		/* current texture loaded */
 		gboolean alpha;
 		rbug_texture_t id;
+		guint tex;
 		unsigned width;
 		unsigned height;
 
-		gulong tid[4];
+		/* shown in tiles instead, see TEXTURE_TILE */
+		gboolean tiled;
+		unsigned level;
+		unsigned layer;
+		GHashTable *tiles_pending;
+		/* level the tiles were last drawn from, see texture_draw_tiles */
+		unsigned tiles_level;
+		/* times the tiles were drawn, see bench_texture_done */
+		guint tiles_draws;
+
+		/* texel at the top left of the view and screen pixels per texel */
+		float pan_x;
+		float pan_y;
+		float zoom;
+
+		gulong tid[5];
 		gboolean automatic;
 		int back;
 
-		int levels[16];
+		/* Auto refresh, in reads a second and ms to the next one */
+		gint auto_rate;
+		guint auto_timer;
+		guint auto_delay;
+		guint auto_generation;
+
+		/* viewed texture as of its last info, for prefetching levels */
+		rbug_texture_t info_id;
+		unsigned format;
+		unsigned depth;
+		unsigned num_levels;
+		struct {
+			unsigned width;
+			unsigned height;
+		} levels[16];
+
+		/* extensions needed by some native uploads, checked once */
+		gboolean gl_checked;
+		gboolean gl_rg;
+		gboolean gl_half_float;
+		gboolean gl_depth_stencil;
+		gboolean gl_pbo;
+
+		/* tiles changed with the last read and out of how many */
+		unsigned dirty_changed;
+		unsigned dirty_tiles;
+
+		/* pixel buffer objects uploads go through, used in turn */
+		guint pbo[2];
+		int pbo_next;
+
+		/* converts levels GL can not take as they are, see TEXTURE_BAND */
+		GThreadPool *pool;
 	} texture;
 
+	struct {
+		GHashTable *hash;
+		GQueue lru;
+		size_t used;
+		/* in MiB, see --texture-cache */
+		gint budget;
+		guint generation;
+	} cache;
+
+	struct {
+		/* best kernels this CPU can run, see src/unpack.c */
+		int level;
+		gboolean f16c;
+	} unpack;
+
+	struct {
+		gboolean enabled;
+		/* struct thumb by texture id, see src/thumb.c */
+		GHashTable *hash;
+		/* reduces read levels to thumbnails */
+		GThreadPool *pool;
+	} thumb;
+
 	struct {
 		int socket;
 		struct rbug_connection *con;
 		GIOChannel *channel;
 		gint event;
+		/* time in us rbug_event may spend dispatching, 0 for one message */
+		gint64 budget;
 		GHashTable *hash_event;
-		GHashTable *hash_reply;
+		/* being dispatched, NULL once taken, see rbug_take_header */
+		struct rbug_header *header;
+
+		/* pending replies, indexed by serial & (ring_size - 1) */
+		struct rbug_reply *ring;
+		uint32_t ring_size;
+		uint32_t ring_base;
+		uint32_t ring_top;
+
+		/* pending requests by (op, id), see rbug_queue_shared */
+		GHashTable *shared;
+
+		/* request scheduler */
+		GQueue queue[RBUG_LANE_NUM];
+		gint window[RBUG_LANE_NUM];
+		unsigned in_flight[RBUG_LANE_NUM];
+
+		/* keep the tree and views when the connection drops, see rbug_lost */
+		gboolean reconnect;
+		gboolean connected;
+		GQueue fences;
 	} rbug;
 
+	struct {
+		GThread *thread;
+
+		/* [0] is used by rbug.con, [1] by the thread */
+		int pair[2];
+		/* written to when there are messages to pop */
+		int wake[2];
+		gint wake_pending;
+
+		gint stop;
+		gint done;
+
+		/* received messages, only the thread moves tail */
+		struct rbug_header *fifo[NET_FIFO_SIZE];
+		gint head;
+		gint tail;
+
+		/* capture, only touched by the thread */
+		char *record_file;
+		FILE *record;
+		gint64 start;
+	} net;
+
+	struct {
+		/* stand in server playing back a capture */
+		char *file;
+		gboolean fast;
+
+		GThread *thread;
+		int socket;
+	} replay;
+
+	struct {
+		/* counters are updated from the network thread */
+		GMutex lock;
+		struct stats_op *ops;
+
+		/* dumped to on exit if set */
+		char *file;
+
+		GtkWidget *panel;
+		GtkTextView *view;
+		guint timeout;
+	} stats;
+
+	struct {
+		gboolean enabled;
+		gboolean failed;
+		guint timer;
+
+		unsigned scenario;
+		gboolean started;
+		int iteration; /* -1 while waiting for the setup */
+		gboolean waiting;
+		gboolean fenced;
+		guint kick; /* which bench_kick the fence in flight is for */
+		guint blocked_count;
+		guint draws; /* p->texture.tiles_draws at the kick */
+
+		gint64 scenario_start;
+		gint64 iteration_start;
+		GArray *latencies;
+		guint64 sent;
+		guint64 received;
+	} bench;
+
 	struct {
 		GHashTable *hash;
 	} icon;
@@ -207,42 +511,97 @@ struct program
 
 /* src/ask.c */
 void ask_window_create(struct program *p);
-gboolean ask_connect(struct program *p);
+void ask_connect(struct program *p);
+void ask_reconnect(struct program *p);
+void ask_stop(struct program *p);
 
 
 /* src/main.c */
 void main_window_create(struct program *p);
 void main_quit(struct program *p);
+void main_disconnected(struct program *p);
+void main_reconnected(struct program *p);
+GHashTable * main_sync_children(GtkTreeIter *parent, enum types type,
+                                const guint64 *ids, unsigned num,
+                                struct program *p);
 gboolean main_find_id(guint64 id, GtkTreeIter *out, struct program *p);
 void main_set_viewed(GtkTreeIter *iter, gboolean force_update, struct program *p);
+void main_visible_schedule(struct program *p);
+void main_add_children(GtkTreeIter *parent, enum types type,
+                       const guint64 *ids, unsigned num,
+                       GHashTable *rows, struct program *p);
 void icon_add(const char *filename, const char *name, struct program *p);
 GdkPixbuf* icon_get(const char *name, struct program *p);
 
 
 /* src/rbug.c */
-void rbug_add_reply(struct rbug_event *e, uint32_t serial, struct program *p);
+void rbug_queue(struct rbug_event *e, enum rbug_lane lane, struct program *p);
+gboolean rbug_unqueue(struct rbug_event *e, enum rbug_lane lane, struct program *p);
+void rbug_queue_shared(struct rbug_event *e, int16_t op, uint64_t id,
+                       enum rbug_lane lane, struct program *p);
 void rbug_add_event(struct rbug_event *e, int16_t op, struct program *p);
-void rbug_glib_io_watch(struct program *p);
-void rbug_finish_and_emit_events(struct program *p);
+gboolean rbug_glib_io_watch(struct program *p);
+void rbug_fence(struct rbug_event *e, struct program *p);
+gboolean rbug_busy(struct program *p);
+struct rbug_header * rbug_take_header(struct program *p);
+
+
+/* src/net.c */
+gboolean net_start(struct program *p);
+void net_stop(struct program *p);
+void net_fini(struct program *p);
+struct rbug_header * net_pop(struct program *p);
+gboolean net_closed(struct program *p);
+void net_wake(struct program *p);
+void net_ack(struct program *p);
+void net_frame(struct net_frame *f, const uint8_t *buf, size_t len,
+               void (*done)(struct rbug_proto_header *, void *), void *data);
+
+
+/* src/replay.c */
+int replay_start(struct program *p);
+void replay_stop(struct program *p);
+
+
+/* src/stats.c */
+void stats_init(struct program *p);
+void stats_fini(struct program *p);
+void stats_setup(GtkWidget *tool, GtkWidget *panel, GtkTextView *view, struct program *p);
+void stats_sent(int16_t op, size_t bytes, struct program *p);
+void stats_received(int16_t op, size_t bytes, struct program *p);
+void stats_latency(int16_t op, gint64 us, struct program *p);
+gboolean stats_dump(const char *filename, struct program *p);
+void stats_totals(guint64 *sent, guint64 *received, struct program *p);
+
+
+/* src/bench.c */
+void bench_start(struct program *p);
+void bench_stop(struct program *p);
 
 
 /* src/context.c */
 void context_unselected(struct program *p);
 void context_selected(struct program *p);
 void context_init(struct program *p);
-void context_list(GtkTreeStore *store,
+gboolean context_all_blocked(struct program *p);
+void context_reconnected(struct program *p);
+void context_list(struct store *store,
                   GtkTreeIter *parent,
                   struct program *p);
 
 
 /* src/texture.c */
-void texture_list(GtkTreeStore *store, GtkTreeIter *parent, struct program *p);
+void texture_list(struct store *store, GtkTreeIter *parent, struct program *p);
+void texture_row_visible(GtkTreeIter *iter, rbug_texture_t id, struct program *p);
 void texture_unselected(struct program *p);
 void texture_selected(struct program *p);
 void texture_unviewed(struct program *p);
 void texture_viewed(struct program *p);
 void texture_refresh(struct program *p);
 void texture_draw(struct program *p);
+void texture_fini(struct program *p);
+void texture_pan(double dx, double dy, struct program *p);
+void texture_zoom(double factor, double x, double y, struct program *p);
 
 
 /* src/shader.c */
@@ -251,12 +610,65 @@ void shader_selected(struct program *p);
 void shader_unviewed(struct program *p);
 void shader_viewed(struct program *p);
 void shader_refresh(struct program *p);
-void shader_list(GtkTreeStore *store,
+void shader_row_visible(GtkTreeIter *iter, rbug_context_t ctx, rbug_shader_t id,
+                        struct program *p);
+void shader_list(struct store *store,
                  GtkTreeIter *parent,
                  rbug_context_t ctx,
                  struct program *p);
 
 
+/* src/cache.c */
+void cache_init(struct program *p);
+void cache_fini(struct program *p);
+struct cache_texture * cache_get(rbug_texture_t id, unsigned level, unsigned layer,
+                                 guint tile, struct program *p);
+struct cache_texture * cache_find(rbug_texture_t id, unsigned level, unsigned layer,
+                                  guint tile, struct program *p);
+struct cache_texture * cache_add(rbug_texture_t id, unsigned level, unsigned layer,
+                                 guint tile, struct program *p);
+void cache_sized(struct cache_texture *t, size_t size, struct program *p);
+void cache_invalidate(struct program *p);
+void cache_invalidate_texture(rbug_texture_t id, struct program *p);
+
+
+/* src/unpack.c */
+void unpack_init(struct program *p);
+gboolean unpack_supported(unsigned format);
+gboolean unpack_rgba8(unsigned format,
+                      const uint8_t *src, unsigned src_stride,
+                      unsigned width, unsigned height,
+                      uint8_t *dst, struct program *p);
+
+
+/* src/thumb.c */
+void thumb_setup(GtkWidget *tool, struct program *p);
+void thumb_fini(struct program *p);
+void thumb_row(GtkTreeIter *iter, rbug_texture_t id, struct program *p);
+GdkPixbuf * thumb_icon(rbug_texture_t id, GdkPixbuf *icon, struct program *p);
+
+
+/* src/store.c */
+struct store * store_new(void);
+void store_freeze(struct store *s);
+void store_thaw(struct store *s);
+void store_clear(struct store *s);
+void store_append(struct store *s, GtkTreeIter *iter, GtkTreeIter *parent,
+                  guint64 id, enum types type);
+void store_remove_rows(struct store *s, GtkTreeIter *parent,
+                       const GtkTreeIter *iters, unsigned num);
+void store_set_pixbuf(struct store *s, GtkTreeIter *iter, GdkPixbuf *pixbuf);
+void store_set_state(struct store *s, GtkTreeIter *iter, enum info_state state);
+void store_reset_state(struct store *s);
+void store_set_texture(struct store *s, GtkTreeIter *iter,
+                       const struct rbug_proto_texture_info_reply *info,
+                       GdkPixbuf *pixbuf);
+guint64 store_id(struct store *s, GtkTreeIter *iter);
+const char * store_typename(struct store *s, GtkTreeIter *iter);
+gboolean store_info_short(struct store *s, GtkTreeIter *iter, char *buf, size_t size);
+gboolean store_info_long(struct store *s, GtkTreeIter *iter, char *buf, size_t size);
+
+
 /* src/draw.c */
 void draw_setup(GtkDrawingArea *draw, struct program *p);
 gboolean draw_gl_begin(struct program *p);
@@ -24,12 +24,19 @@
 
 #include "program.h"
 
+#include "rbug/rbug_internal.h"
+
 #define OP2KEY(o) ((void*)(long)o)
 #define KEY2OP(k) ((int16_t)(long)k)
 
-#define SERIAL2KEY(s) ((void*)(unsigned long)s)
 #define KEY2SERIAL(k) ((uint32_t)(unsigned long)k)
 
+/* how long rbug_event may keep dispatching messages, in microseconds */
+#define RBUG_DISPATCH_BUDGET (8 * 1000)
+
+/* initial number of outstanding replies, must be a power of two */
+#define RBUG_RING_SIZE 256
+
 static guint hash_func(gconstpointer key)
 {
 	return KEY2SERIAL(key);
@@ -40,6 +47,15 @@ static gboolean equal_func(gconstpointer a, gconstpointer b)
 	return KEY2SERIAL(a) == KEY2SERIAL(b);
 }
 
+/* free the dispatched header unless the handler took it */
+static void rbug_release_header(struct program *p)
+{
+	if (p->rbug.header)
+		rbug_free_header(p->rbug.header);
+
+	p->rbug.header = NULL;
+}
+
 static void rbug_handle_header_event(struct rbug_header *header, struct program *p)
 {
 	struct rbug_event *e;
@@ -58,113 +74,464 @@ static void rbug_handle_header_event(struct rbug_header *header, struct program
 	}
 
 	e = (struct rbug_event *)ptr;
+	p->rbug.header = header;
 	ret = e->func(e, header, p);
 
 	if (!ret)
 		g_hash_table_remove(p->rbug.hash_event, OP2KEY(op));
 
-	rbug_free_header(header);
+	rbug_release_header(p);
 }
 
-static void rbug_handle_header_reply(struct rbug_header *header, struct program *p)
+/*
+ * Pending replies are kept in a ring indexed by serial, the window
+ * [ring_base, ring_top) covers every serial that might still be waiting
+ * for a reply. Serials only ever increase so the window just slides
+ * forward as replies come in, and grows when too many are in flight.
+ */
+
+static void rbug_ring_grow(struct program *p)
+{
+	struct rbug_reply *old = p->rbug.ring;
+	uint32_t old_mask = p->rbug.ring_size - 1;
+	uint32_t size = p->rbug.ring_size * 2;
+	uint32_t s;
+
+	p->rbug.ring = g_malloc0(sizeof(*p->rbug.ring) * size);
+	p->rbug.ring_size = size;
+
+	for (s = p->rbug.ring_base; s != p->rbug.ring_top; s++)
+		p->rbug.ring[s & (size - 1)] = old[s & old_mask];
+
+	g_free(old);
+}
+
+/*
+ * Take the request serial is the reply to. A reply of another kind than
+ * the request is left alone, its handler could not make sense of it.
+ * Only a replay that went differently from its capture sends those.
+ */
+static gboolean rbug_ring_take(uint32_t serial, int32_t opcode,
+                               struct rbug_reply *out, struct program *p)
+{
+	uint32_t mask = p->rbug.ring_size - 1;
+	struct rbug_reply *slot;
+
+	if (serial - p->rbug.ring_base >= p->rbug.ring_top - p->rbug.ring_base)
+		return FALSE;
+
+	slot = &p->rbug.ring[serial & mask];
+	if (!slot->e || slot->serial != serial)
+		return FALSE;
+
+	if (opcode != -slot->op && opcode != RBUG_OP_ERROR_REPLY) {
+		g_print("reply %i does not match request %i with id %u\n",
+		        opcode, slot->op, serial);
+		return FALSE;
+	}
+
+	*out = *slot;
+	slot->e = NULL;
+
+	/* slide the window past answered requests */
+	while (p->rbug.ring_base != p->rbug.ring_top &&
+	       !p->rbug.ring[p->rbug.ring_base & mask].e)
+		p->rbug.ring_base++;
+
+	return TRUE;
+}
+
+static void rbug_add_reply(struct rbug_event *e, int16_t op, uint32_t serial,
+                           enum rbug_lane lane, struct program *p)
+{
+	struct rbug_reply *slot;
+
+	/* nothing in flight, start the window at this serial */
+	if (p->rbug.ring_base == p->rbug.ring_top)
+		p->rbug.ring_base = p->rbug.ring_top = serial;
+
+	while (serial - p->rbug.ring_base >= p->rbug.ring_size)
+		rbug_ring_grow(p);
+
+	slot = &p->rbug.ring[serial & (p->rbug.ring_size - 1)];
+	g_assert(!slot->e);
+
+	slot->e = e;
+	slot->sent = g_get_monotonic_time();
+	slot->serial = serial;
+	slot->op = op;
+	slot->lane = lane;
+
+	if (serial - p->rbug.ring_base >= p->rbug.ring_top - p->rbug.ring_base)
+		p->rbug.ring_top = serial + 1;
+}
+
+/*
+ * Requests are queued per lane and only sent while the lane has fewer
+ * than window[lane] requests in flight, so a large batch of background
+ * requests can never sit in front of what the user is looking at.
+ */
+
+static void rbug_pump(struct program *p)
 {
 	struct rbug_event *e;
 	uint32_t serial;
-	void *ptr;
+	unsigned window;
+	int16_t op;
+	int lane;
+
+	/* held back until reconnected */
+	if (!p->rbug.connected)
+		return;
+
+	for (lane = 0; lane < RBUG_LANE_NUM; lane++) {
+		window = MAX(p->rbug.window[lane], 1);
+
+		while (p->rbug.in_flight[lane] < window &&
+		       !g_queue_is_empty(&p->rbug.queue[lane])) {
+			e = g_queue_pop_head(&p->rbug.queue[lane]);
+
+			serial = 0;
+			op = e->send(e, &serial, p);
+
+			rbug_add_reply(e, op, serial, lane, p);
+			p->rbug.in_flight[lane]++;
+		}
+	}
+}
+
+static void rbug_handle_header_reply(struct rbug_header *header, struct program *p)
+{
+	struct rbug_reply reply;
+	uint32_t serial;
 
 	g_assert(header->opcode < 0);
 	serial = *(uint32_t*)&header[1];
 
-	ptr = g_hash_table_lookup(p->rbug.hash_reply, SERIAL2KEY(serial));
-	g_hash_table_remove(p->rbug.hash_reply, SERIAL2KEY(serial));
-
-	if (!ptr) {
+	if (!rbug_ring_take(serial, header->opcode, &reply, p)) {
 		g_print("lost message with id %u\n", serial);
+		rbug_free_header(header);
 		return;
 	}
 
-	e = (struct rbug_event *)ptr;
-	e->func(e, header, p);
+	if (reply.lane < RBUG_LANE_NUM)
+		p->rbug.in_flight[reply.lane]--;
+
+	stats_latency(reply.op, g_get_monotonic_time() - reply.sent, p);
+
+	p->rbug.header = header;
+	reply.e->func(reply.e, header, p);
+
+	rbug_release_header(p);
 
-	rbug_free_header(header);
+	rbug_pump(p);
+}
+
+static void rbug_handle_header(struct rbug_header *header, struct program *p)
+{
+	if (header->opcode >= 0)
+		rbug_handle_header_event(header, p);
+	else
+		rbug_handle_header_reply(header, p);
+}
+
+/**
+ * The connection went away.
+ *
+ * Without --reconnect that is the end of it. Otherwise only the socket
+ * is dropped, everything that was still waiting for a reply is put back
+ * at the front of its lane and sent again once ask_reconnect has found
+ * the application again, the tree and whatever is viewed are kept.
+ */
+static void rbug_lost(struct program *p)
+{
+	GQueue resend[RBUG_LANE_NUM];
+	struct rbug_reply *slot;
+	struct rbug_event *e;
+	uint32_t s;
+	int lane;
+
+	if (!p->rbug.reconnect || p->replay.file) {
+		main_quit(p);
+		return;
+	}
+
+	/* the connection is kept until reconnected, sends on it just fail */
+	net_stop(p);
+	g_io_channel_unref(p->rbug.channel);
+	p->rbug.channel = NULL;
+	p->rbug.event = 0;
+	p->rbug.connected = FALSE;
+
+	for (lane = 0; lane < RBUG_LANE_NUM; lane++)
+		g_queue_init(&resend[lane]);
+
+	for (s = p->rbug.ring_base; s != p->rbug.ring_top; s++) {
+		slot = &p->rbug.ring[s & (p->rbug.ring_size - 1)];
+		if (!slot->e)
+			continue;
+
+		if (slot->lane < RBUG_LANE_NUM)
+			g_queue_push_tail(&resend[slot->lane], slot->e);
+		else
+			g_queue_push_tail(&p->rbug.fences, slot->e);
+
+		slot->e = NULL;
+	}
+
+	p->rbug.ring_base = p->rbug.ring_top = 0;
+
+	for (lane = 0; lane < RBUG_LANE_NUM; lane++) {
+		while ((e = g_queue_pop_tail(&resend[lane])))
+			g_queue_push_head(&p->rbug.queue[lane], e);
+
+		p->rbug.in_flight[lane] = 0;
+	}
+
+	main_disconnected(p);
 }
 
 static gboolean rbug_event(GIOChannel *channel, GIOCondition c, gpointer data)
 {
 	struct program *p = (struct program *)data;
-	struct rbug_connection *con = p->rbug.con;
 	struct rbug_header *header;
+	gint64 end;
 	(void)channel;
 
 	if (c & (G_IO_IN | G_IO_PRI)) {
-		header = rbug_get_message(con, NULL);
-		if (!header) {
-			main_quit(p);
+		net_ack(p);
+
+		end = g_get_monotonic_time() + p->rbug.budget;
+
+		/* dispatch everything the network thread has received, within the budget */
+		do {
+			header = net_pop(p);
+			if (!header)
+				break;
+
+			rbug_handle_header(header, p);
+		} while (g_get_monotonic_time() < end);
+
+		if (net_closed(p)) {
+			rbug_lost(p);
 			return false;
 		}
 
-		if (header->opcode >= 0)
-			rbug_handle_header_event(header, p);
-		else
-			rbug_handle_header_reply(header, p);
+		/* out of time, come back after drawing */
+		if (header)
+			net_wake(p);
 	}
 
 	if (c & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
-		main_quit(p);
+		rbug_lost(p);
 		return false;
 	}
 
 	return true;
 }
 
+/*
+ * Identical requests for the same object are sent once. The first
+ * rbug_queue_shared for an (op, id) queues a struct rbug_shared that
+ * sends on behalf of every waiter, later ones just join its list and
+ * all of them get the reply. A request that is already on the wire is
+ * only joined if nothing has been sent after it, a step or flush sent
+ * in between could make its reply stale.
+ */
+
+struct rbug_shared
+{
+	struct rbug_event e;
+
+	int16_t op;
+	uint64_t id;
+	enum rbug_lane lane;
+
+	/* struct rbug_event, in the order they asked */
+	GQueue waiters;
+
+	gboolean sent;
+	/* con->send_serial right after it was sent */
+	uint32_t after;
+};
+
+static guint rbug_shared_hash(gconstpointer key)
+{
+	const struct rbug_shared *s = key;
+
+	return g_int64_hash(&s->id) ^ (guint)s->op;
+}
+
+static gboolean rbug_shared_equal(gconstpointer a, gconstpointer b)
+{
+	const struct rbug_shared *x = a;
+	const struct rbug_shared *y = b;
+
+	return x->op == y->op && x->id == y->id;
+}
+
+static int16_t rbug_shared_send(struct rbug_event *e, uint32_t *serial, struct program *p)
+{
+	struct rbug_shared *s = (struct rbug_shared *)e;
+	struct rbug_event *first = g_queue_peek_head(&s->waiters);
+	int16_t op;
+
+	op = first->send(first, serial, p);
+
+	s->sent = TRUE;
+	s->after = p->rbug.con->send_serial;
+
+	return op;
+}
+
+static gboolean rbug_shared_func(struct rbug_event *e, struct rbug_header *header, struct program *p)
+{
+	struct rbug_shared *s = (struct rbug_shared *)e;
+	struct rbug_event *w;
+
+	/* a newer one might have taken its place already */
+	if (g_hash_table_lookup(p->rbug.shared, s) == s)
+		g_hash_table_remove(p->rbug.shared, s);
+
+	while ((w = g_queue_pop_head(&s->waiters))) {
+		/* the header has to stay for the next waiter */
+		g_assert(p->rbug.header == header);
+		w->func(w, header, p);
+	}
+
+	g_free(s);
+
+	return FALSE;
+}
+
 /*
  * exported
  */
 
-void rbug_finish_and_emit_events(struct program *p)
+/**
+ * Queue a fence, e->func is called with the ping reply once every
+ * request sent before it has been answered. Never blocks.
+ */
+void rbug_fence(struct rbug_event *e, struct program *p)
 {
-	struct rbug_connection *con = p->rbug.con;
-	struct rbug_header *header;
-	uint32_t serial;
+	uint32_t serial = 0;
 
-	rbug_send_ping(con, &serial);
+	if (!p->rbug.connected) {
+		g_queue_push_tail(&p->rbug.fences, e);
+		return;
+	}
 
-	do {
-		header = rbug_get_message(con, NULL);
+	rbug_send_ping(p->rbug.con, &serial);
 
-		if (!header) {
-			g_print("Connection problems\n");
-			break;
-		}
+	/* replies come back in order, so this is the last one */
+	rbug_add_reply(e, RBUG_OP_PING, serial, RBUG_LANE_NUM, p);
+}
 
-		if (header->opcode < 0) {
-			uint32_t s =*(uint32_t*)(&header[1]);
-			if (s == serial) {
-				break;
-			} else if (s > serial) {
-				g_print("Bad bad bad lost message that we waited for\n");
-				break;
-			}
-		}
+/**
+ * Are any requests queued or waiting for a reply.
+ */
+gboolean rbug_busy(struct program *p)
+{
+	int lane;
 
-		if (header->opcode >= 0)
-			rbug_handle_header_event(header, p);
-		else
-			rbug_handle_header_reply(header, p);
+	if (p->rbug.ring_base != p->rbug.ring_top ||
+	    !g_queue_is_empty(&p->rbug.fences))
+		return TRUE;
+
+	for (lane = 0; lane < RBUG_LANE_NUM; lane++)
+		if (!g_queue_is_empty(&p->rbug.queue[lane]))
+			return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * Queue a request, e->send is called to send it once the lane
+ * has room and e->func is then called with the reply.
+ */
+void rbug_queue(struct rbug_event *e, enum rbug_lane lane, struct program *p)
+{
+	g_assert(lane < RBUG_LANE_NUM);
+
+	g_queue_push_tail(&p->rbug.queue[lane], e);
 
-		header = NULL;
-	} while (1);
+	rbug_pump(p);
+}
 
-	if (header && header->opcode != RBUG_OP_PING_REPLY) {
-		g_print("Bad bad bad reply which we waited for was not ping\n");
+/**
+ * Take back a request queued with rbug_queue that has not been sent yet,
+ * returns FALSE if it already went out and e->func will still be called.
+ */
+gboolean rbug_unqueue(struct rbug_event *e, enum rbug_lane lane, struct program *p)
+{
+	g_assert(lane < RBUG_LANE_NUM);
+
+	return g_queue_remove(&p->rbug.queue[lane], e);
+}
+
+/**
+ * Like rbug_queue, but if a request with the same op for the same
+ * object id is already pending e waits for its reply instead of sending
+ * another one. e->func must not take the header.
+ */
+void rbug_queue_shared(struct rbug_event *e, int16_t op, uint64_t id,
+                       enum rbug_lane lane, struct program *p)
+{
+	struct rbug_shared key;
+	struct rbug_shared *s;
+
+	g_assert(lane < RBUG_LANE_NUM);
+
+	key.op = op;
+	key.id = id;
+	s = g_hash_table_lookup(p->rbug.shared, &key);
+
+	if (s && s->sent && s->after != p->rbug.con->send_serial)
+		s = NULL;
+
+	if (s) {
+		g_queue_push_tail(&s->waiters, e);
+
+		/* still queued behind the tree, move it up */
+		if (!s->sent && lane < s->lane) {
+			g_queue_remove(&p->rbug.queue[s->lane], &s->e);
+			g_queue_push_tail(&p->rbug.queue[lane], &s->e);
+			s->lane = lane;
+			rbug_pump(p);
+		}
+		return;
 	}
 
-	rbug_free_header(header);
+	s = g_malloc(sizeof(*s));
+	memset(s, 0, sizeof(*s));
+
+	s->e.func = rbug_shared_func;
+	s->e.send = rbug_shared_send;
+	s->op = op;
+	s->id = id;
+	s->lane = lane;
+	g_queue_init(&s->waiters);
+	g_queue_push_tail(&s->waiters, e);
+
+	/* replaces a stale one, which still answers its own waiters */
+	g_hash_table_replace(p->rbug.shared, s, s);
+
+	rbug_queue(&s->e, lane, p);
 }
 
-void rbug_add_reply(struct rbug_event *e, uint32_t serial, struct program *p)
+/**
+ * Take ownership of the header currently being dispatched, only valid
+ * from inside e->func. The caller frees it with rbug_free_header, any
+ * data in the reply points into it and can be used without a copy.
+ */
+struct rbug_header * rbug_take_header(struct program *p)
 {
-	g_hash_table_insert(p->rbug.hash_reply, SERIAL2KEY(serial), e);
+	struct rbug_header *header = p->rbug.header;
+
+	g_assert(header);
+	p->rbug.header = NULL;
+
+	return header;
 }
 
 void rbug_add_event(struct rbug_event *e, int16_t op, struct program *p)
@@ -172,13 +539,44 @@ void rbug_add_event(struct rbug_event *e, int16_t op, struct program *p)
 	g_hash_table_insert(p->rbug.hash_event, OP2KEY(op), e);
 }
 
-void rbug_glib_io_watch(struct program *p)
+/**
+ * Set up the connection on p->rbug.socket. Called again with a new
+ * socket after rbug_lost, requests queued meanwhile are then sent.
+ */
+gboolean rbug_glib_io_watch(struct program *p)
 {
 	gint mask = (G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP | G_IO_NVAL);
+	struct rbug_connection *old = p->rbug.con;
+	struct rbug_event *e;
+
+	if (!net_start(p))
+		return FALSE;
 
-	p->rbug.channel = g_io_channel_unix_new(p->rbug.socket);
+	if (old)
+		rbug_disconnect(old);
+
+	p->rbug.channel = g_io_channel_unix_new(p->net.wake[0]);
 	p->rbug.event = g_io_add_watch(p->rbug.channel, mask, rbug_event, p);
 	g_io_channel_set_encoding(p->rbug.channel, NULL, NULL);
-	p->rbug.hash_event = g_hash_table_new(hash_func, equal_func);
-	p->rbug.hash_reply = g_hash_table_new(hash_func, equal_func);
+	p->rbug.connected = TRUE;
+
+	if (!p->rbug.hash_event) {
+		p->rbug.budget = RBUG_DISPATCH_BUDGET;
+		p->rbug.hash_event = g_hash_table_new(hash_func, equal_func);
+		p->rbug.shared = g_hash_table_new(rbug_shared_hash, rbug_shared_equal);
+		p->rbug.ring = g_malloc0(sizeof(*p->rbug.ring) * RBUG_RING_SIZE);
+		p->rbug.ring_size = RBUG_RING_SIZE;
+		g_queue_init(&p->rbug.queue[RBUG_LANE_INTERACTIVE]);
+		g_queue_init(&p->rbug.queue[RBUG_LANE_BACKGROUND]);
+		g_queue_init(&p->rbug.fences);
+		return TRUE;
+	}
+
+	rbug_pump(p);
+
+	/* after the requests they were fencing */
+	while ((e = g_queue_pop_head(&p->rbug.fences)))
+		rbug_fence(e, p);
+
+	return TRUE;
 }
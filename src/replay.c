@@ -0,0 +1,416 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Stand in server that plays back a capture made with --record.
+ *
+ * Received messages from the capture are sent back in order. A reply
+ * is held until we have made a request like the one it answered in the
+ * capture, the same op for the same bytes or failing that for the same
+ * object, and its serial is rewritten to that of our request. That way
+ * a reply is never handed out before its request has been made and
+ * always goes to a request it fits, even if the requests are not made
+ * in the recorded order. A reply is dropped if it is still not asked for
+ * REPLAY_WAIT ms after as many requests were made as up to its own in
+ * the capture. Unless --replay-fast is given the recorded delay from the
+ * request, or from the message before, is kept too.
+ *
+ * Serials count the messages sent on a connection, from 0. A capture
+ * can span reconnects, see NET_RECORD_CONNECTED, serials of replies are
+ * then relative to the start of their connection. Requests that were
+ * still unanswered are sent again after a reconnect but only once here,
+ * so they do not count towards how many requests a reply waits for.
+ */
+
+#include "program.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define REPLAY_CHUNK (64 * 1024)
+
+/* in ms, see above */
+#define REPLAY_WAIT 2000
+
+/* a message we sent, see net_frame */
+struct replay_request
+{
+	/* us since the connection in the capture, g_get_monotonic_time live */
+	gint64 time;
+	int32_t opcode;
+	guint64 id;
+	guint64 hash;
+	gboolean answered;
+};
+
+struct replay
+{
+	struct program *p;
+	FILE *file;
+	int socket;
+
+	/* what we sent, in the capture */
+	struct net_frame capture;
+	GArray *captured;
+	guint64 now;
+	/* first of the connection in captured, and how many were sent again */
+	guint base;
+	guint resent;
+
+	/* and in this replay */
+	struct net_frame live;
+	GArray *lived;
+};
+
+/* requests the server replies to, those are sent again on a reconnect */
+static gboolean replay_has_reply(int32_t opcode)
+{
+	switch (opcode) {
+	case RBUG_OP_PING:
+	case RBUG_OP_TEXTURE_LIST:
+	case RBUG_OP_TEXTURE_INFO:
+	case RBUG_OP_TEXTURE_READ:
+	case RBUG_OP_CONTEXT_LIST:
+	case RBUG_OP_CONTEXT_INFO:
+	case RBUG_OP_SHADER_LIST:
+	case RBUG_OP_SHADER_INFO:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/* the capture starts over on a new connection */
+static void replay_connected(struct replay *r)
+{
+	struct replay_request *req;
+	guint i;
+
+	for (i = r->base; i < r->captured->len; i++) {
+		req = &g_array_index(r->captured, struct replay_request, i);
+		if (!req->answered && replay_has_reply(req->opcode))
+			r->resent++;
+	}
+
+	r->base = r->captured->len;
+	memset(&r->capture, 0, sizeof(r->capture));
+}
+
+static void replay_request(GArray *requests, struct net_frame *f, gint64 time)
+{
+	struct replay_request req;
+
+	req.time = time;
+	req.opcode = f->header.opcode;
+	req.id = f->id;
+	req.hash = f->hash;
+	req.answered = FALSE;
+
+	g_array_append_val(requests, req);
+}
+
+static void replay_captured(struct rbug_proto_header *header, void *data)
+{
+	struct replay *r = (struct replay *)data;
+	(void)header;
+
+	replay_request(r->captured, &r->capture, r->now);
+}
+
+static void replay_lived(struct rbug_proto_header *header, void *data)
+{
+	struct replay *r = (struct replay *)data;
+	(void)header;
+
+	replay_request(r->lived, &r->live, g_get_monotonic_time());
+}
+
+/**
+ * Our request that want was in the capture and is not answered yet, -1 if none.
+ */
+static int replay_match(struct replay *r, const struct replay_request *want)
+{
+	struct replay_request *req;
+	guint i;
+
+	for (i = 0; i < r->lived->len; i++) {
+		req = &g_array_index(r->lived, struct replay_request, i);
+		if (!req->answered && req->opcode == want->opcode && req->hash == want->hash)
+			return i;
+	}
+
+	for (i = 0; i < r->lived->len; i++) {
+		req = &g_array_index(r->lived, struct replay_request, i);
+		if (!req->answered && req->opcode == want->opcode && req->id == want->id)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Take in what has been sent to us, waiting at most timeout ms.
+ */
+static gboolean replay_read(struct replay *r, int timeout)
+{
+	uint8_t buf[REPLAY_CHUNK];
+	struct pollfd fd;
+	ssize_t ret;
+
+	fd.fd = r->socket;
+	fd.events = POLLIN;
+	fd.revents = 0;
+
+	ret = poll(&fd, 1, timeout);
+	if (ret < 0)
+		return errno == EINTR;
+	if (ret == 0)
+		return TRUE;
+
+	ret = read(r->socket, buf, sizeof(buf));
+	if (ret <= 0)
+		return ret < 0 && errno == EINTR;
+
+	net_frame(&r->live, buf, ret, replay_lived, r);
+
+	return TRUE;
+}
+
+static gboolean replay_write(struct replay *r, const uint8_t *buf, size_t size)
+{
+	ssize_t sent;
+
+	while (size) {
+		sent = send(r->socket, buf, size, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+
+		buf += sent;
+		size -= sent;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Wait for the request that the reply in buf answers and rewrite its
+ * serial. want and live are what that request was in the capture and
+ * what it is now, live.answered is left FALSE if the reply is to be
+ * dropped. Returns FALSE once the other end has gone away.
+ */
+static gboolean replay_answer(struct replay *r, uint8_t *buf, size_t size,
+                              struct replay_request *want,
+                              struct replay_request *live)
+{
+	uint32_t *serial = (uint32_t *)(buf + sizeof(struct rbug_proto_header));
+	gint64 until = 0;
+	gint64 now;
+	guint need;
+	int i;
+
+	memset(live, 0, sizeof(*live));
+
+	if (size < sizeof(struct rbug_proto_header) + sizeof(*serial) ||
+	    *serial >= r->captured->len - r->base) {
+		g_print("replay reply without a request, dropped\n");
+		return TRUE;
+	}
+
+	g_array_index(r->captured, struct replay_request, r->base + *serial).answered = TRUE;
+	*want = g_array_index(r->captured, struct replay_request, r->base + *serial);
+	need = r->base + *serial + 1 - MIN(r->resent, r->base + *serial);
+
+	while ((i = replay_match(r, want)) < 0) {
+		/* it may still come as long as fewer were made than captured */
+		if (r->lived->len < need) {
+			if (!replay_read(r, -1))
+				return FALSE;
+			continue;
+		}
+
+		now = g_get_monotonic_time();
+		if (!until)
+			until = now + REPLAY_WAIT * 1000;
+
+		if (now >= until) {
+			g_print("replay reply to op %i not asked for, dropped\n", want->opcode);
+			return TRUE;
+		}
+
+		if (!replay_read(r, (until - now) / 1000 + 1))
+			return FALSE;
+	}
+
+	g_array_index(r->lived, struct replay_request, i).answered = TRUE;
+	*live = g_array_index(r->lived, struct replay_request, i);
+	*serial = i;
+
+	return TRUE;
+}
+
+static gpointer replay_thread(gpointer data)
+{
+	struct replay *r = (struct replay *)data;
+	struct replay_request want, live;
+	struct net_record rec;
+	gint64 rec_ref, prev_rec = 0;
+	gint64 live_ref, prev_live = 0;
+	gint64 until, now;
+	uint8_t *buf = NULL;
+
+	/* the capture starts with the connection */
+	prev_live = g_get_monotonic_time();
+
+	while (fread(&rec, sizeof(rec), 1, r->file) == 1) {
+		buf = g_realloc(buf, MAX(rec.size, 1));
+		if (fread(buf, 1, rec.size, r->file) != rec.size)
+			break;
+
+		if (rec.dir == NET_RECORD_SENT) {
+			r->now = rec.time;
+			net_frame(&r->capture, buf, rec.size, replay_captured, r);
+			continue;
+		}
+
+		if (rec.dir == NET_RECORD_CONNECTED) {
+			replay_connected(r);
+			continue;
+		}
+
+		/* events go out as they are, replies to the request they fit */
+		want.time = 0;
+		if (rec.size >= sizeof(struct rbug_proto_header) &&
+		    ((struct rbug_proto_header *)buf)->opcode < 0) {
+			if (!replay_answer(r, buf, rec.size, &want, &live))
+				goto out;
+			if (!live.answered)
+				continue;
+		}
+
+		if (!r->p->replay.fast) {
+			rec_ref = prev_rec;
+			live_ref = prev_live;
+
+			if (want.time > rec_ref) {
+				rec_ref = want.time;
+				live_ref = live.time;
+			}
+
+			until = live_ref + ((gint64)rec.time - MIN(rec_ref, (gint64)rec.time));
+
+			while ((now = g_get_monotonic_time()) < until)
+				if (!replay_read(r, (until - now) / 1000 + 1))
+					goto out;
+		}
+
+		if (!replay_write(r, buf, rec.size))
+			goto out;
+
+		prev_rec = rec.time;
+		prev_live = g_get_monotonic_time();
+	}
+
+	g_print("replay finished\n");
+
+	/* keep taking requests until the other end goes away */
+	while (replay_read(r, -1));
+
+out:
+	g_free(buf);
+	fclose(r->file);
+	g_array_free(r->captured, TRUE);
+	g_array_free(r->lived, TRUE);
+	g_free(r);
+
+	return NULL;
+}
+
+
+/*
+ * Exported
+ */
+
+
+/**
+ * Start playing back p->replay.file, returns the socket
+ * to use in place of a connection or -1 on failure.
+ */
+int replay_start(struct program *p)
+{
+	char magic[sizeof(NET_RECORD_MAGIC) - 1];
+	struct replay *r;
+	int pair[2];
+	FILE *file;
+
+	file = fopen(p->replay.file, "rb");
+	if (!file) {
+		g_print("failed to open capture file %s\n", p->replay.file);
+		return -1;
+	}
+
+	if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+	    memcmp(magic, NET_RECORD_MAGIC, sizeof(magic))) {
+		g_print("%s is not a capture file\n", p->replay.file);
+		fclose(file);
+		return -1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+		fclose(file);
+		return -1;
+	}
+
+	r = g_malloc(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->p = p;
+	r->file = file;
+	r->socket = pair[1];
+	r->captured = g_array_new(FALSE, FALSE, sizeof(struct replay_request));
+	r->lived = g_array_new(FALSE, FALSE, sizeof(struct replay_request));
+
+	p->replay.socket = pair[1];
+	p->replay.thread = g_thread_new("rbug-replay", replay_thread, r);
+
+	return pair[0];
+}
+
+/**
+ * Called once our end of the socket has been closed.
+ */
+void replay_stop(struct program *p)
+{
+	if (!p->replay.thread)
+		return;
+
+	g_thread_join(p->replay.thread);
+	p->replay.thread = NULL;
+
+	close(p->replay.socket);
+}
@@ -39,10 +39,12 @@ static struct shader_action_info *
 shader_start_info_action(rbug_context_t c,
                          rbug_shader_t s,
                          GtkTreeIter *iter,
+                         enum rbug_lane lane,
                          struct program *p);
 static void shader_stop_info_action(struct shader_action_info *info, struct program *p);
+static void shader_start_edit_action(struct program *p);
 
-static void shader_start_list_action(GtkTreeStore *store, GtkTreeIter *parent,
+static void shader_start_list_action(struct store *store, GtkTreeIter *parent,
                                      rbug_context_t ctx, struct program *p);
 
 
@@ -58,14 +60,12 @@ static void disable(GtkWidget *widget, struct program *p)
 
 	g_assert(p->viewed.type == TYPE_SHADER);
 
-	rbug_finish_and_emit_events(p);
 	rbug_send_shader_disable(con, p->viewed.parent, p->viewed.id, true, NULL);
-	rbug_finish_and_emit_events(p);
 
 	gtk_widget_hide(p->tool.disable);
 	gtk_widget_show(p->tool.enable);
 
-	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter, p);
+	shader_start_edit_action(p);
 }
 
 static void enable(GtkWidget *widget, struct program *p)
@@ -75,14 +75,12 @@ static void enable(GtkWidget *widget, struct program *p)
 
 	g_assert(p->viewed.type == TYPE_SHADER);
 
-	rbug_finish_and_emit_events(p);
 	rbug_send_shader_disable(con, p->viewed.parent, p->viewed.id, false, NULL);
-	rbug_finish_and_emit_events(p);
 
 	gtk_widget_show(p->tool.disable);
 	gtk_widget_hide(p->tool.enable);
 
-	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter, p);
+	shader_start_edit_action(p);
 }
 
 static void update_text(struct rbug_proto_shader_info_reply *info, struct program *p)
@@ -113,11 +111,9 @@ static void revert(GtkWidget *widget, struct program *p)
 
 	g_assert(p->viewed.type == TYPE_SHADER);
 
-	rbug_finish_and_emit_events(p);
 	rbug_send_shader_replace(con, p->viewed.parent, p->viewed.id, NULL, 0, NULL);
-	rbug_finish_and_emit_events(p);
 
-	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter, p);
+	shader_start_edit_action(p);
 }
 
 static void save(GtkWidget *widget, struct program *p)
@@ -135,8 +131,6 @@ static void save(GtkWidget *widget, struct program *p)
 	g_assert(p->viewed.type == TYPE_SHADER);
 	g_assert(sizeof(struct tgsi_token) == 4);
 
-	rbug_finish_and_emit_events(p);
-
 	buffer = gtk_text_view_get_buffer(p->main.textview);
 	gtk_text_buffer_get_start_iter(buffer, &start);
 	gtk_text_buffer_get_end_iter(buffer, &end);
@@ -154,9 +148,7 @@ static void save(GtkWidget *widget, struct program *p)
 
 	gtk_widget_show(p->tool.revert);
 
-	rbug_finish_and_emit_events(p);
-
-	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter, p);
+	shader_start_edit_action(p);
 
 out:
 	g_free(text);
@@ -166,7 +158,8 @@ void shader_refresh(struct program *p)
 {
 	g_assert(p->viewed.type == TYPE_SHADER);
 
-	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter, p);
+	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter,
+	                         RBUG_LANE_INTERACTIVE, p);
 }
 
 void shader_viewed(struct program *p)
@@ -184,7 +177,8 @@ void shader_viewed(struct program *p)
 	if (p->shader.info)
 		shader_stop_info_action(p->shader.info, p);
 
-	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter, p);
+	shader_start_info_action(p->viewed.parent, p->viewed.id, &p->viewed.iter,
+	                         RBUG_LANE_INTERACTIVE, p);
 }
 
 void shader_unviewed(struct program *p)
@@ -212,12 +206,23 @@ void shader_selected(struct program *p)
 	main_set_viewed(&p->selected.iter, FALSE, p);
 }
 
-void shader_list(GtkTreeStore *store, GtkTreeIter *parent,
+void shader_list(struct store *store, GtkTreeIter *parent,
                  rbug_context_t ctx, struct program *p)
 {
 	shader_start_list_action(store, parent, ctx, p);
 }
 
+/**
+ * Fetch the info of a listed shader that came into view.
+ */
+void shader_row_visible(GtkTreeIter *iter, rbug_context_t ctx, rbug_shader_t id,
+                        struct program *p)
+{
+	store_set_state(p->main.store, iter, INFO_PENDING);
+
+	shader_start_info_action(ctx, id, iter, RBUG_LANE_BACKGROUND, p);
+}
+
 
 /*
  * Action fuctions
@@ -274,7 +279,8 @@ static gboolean shader_action_info_info(struct rbug_event *e,
 		else
 			buf = icon_get("shader_on_replaced", p);
 	}
-	gtk_tree_store_set(p->main.treestore, &action->iter, COLUMN_PIXBUF, buf, -1);
+	store_set_state(p->main.store, &action->iter, INFO_DONE);
+	store_set_pixbuf(p->main.store, &action->iter, buf);
 
 	if (p->viewed.id != action->sid)
 		goto out;
@@ -297,29 +303,38 @@ out:
 	return FALSE;
 }
 
+static int16_t shader_action_info_send(struct rbug_event *e,
+                                       uint32_t *serial,
+                                       struct program *p)
+{
+	struct shader_action_info *action = (struct shader_action_info *)e;
+
+	rbug_send_shader_info(p->rbug.con, action->cid, action->sid, serial);
+
+	return RBUG_OP_SHADER_INFO;
+}
+
 static struct shader_action_info *
 shader_start_info_action(rbug_context_t c,
                          rbug_shader_t s,
                          GtkTreeIter *iter,
+                         enum rbug_lane lane,
                          struct program *p)
 {
-	struct rbug_connection *con = p->rbug.con;
 	struct shader_action_info *action;
-	uint32_t serial = 0;
 
 	action = g_malloc(sizeof(*action));
 	memset(action, 0, sizeof(*action));
 
-	rbug_send_shader_info(con, c, s, &serial);
-
 	action->e.func = shader_action_info_info;
+	action->e.send = shader_action_info_send;
 	action->cid = c;
 	action->sid = s;
 	action->iter = *iter;
 	action->pending = TRUE;
 	action->running = TRUE;
 
-	rbug_add_reply(&action->e, serial, p);
+	rbug_queue_shared(&action->e, RBUG_OP_SHADER_INFO, s, lane, p);
 
 	return action;
 }
@@ -335,13 +350,60 @@ static void shader_stop_info_action(struct shader_action_info *action, struct pr
 		shader_action_info_clean(action, p);
 }
 
+/**
+ * Follows a change to the viewed shader, once the driver has
+ * processed the change the shader info is downloaded again.
+ */
+struct shader_action_edit
+{
+	struct rbug_event e;
+
+	rbug_context_t cid;
+	rbug_shader_t sid;
+
+	GtkTreeIter iter;
+};
+
+static gboolean shader_action_edit_fence(struct rbug_event *e,
+                                         struct rbug_header *header,
+                                         struct program *p)
+{
+	struct shader_action_edit *action;
+
+	action = (struct shader_action_edit *)e;
+
+	g_assert(header->opcode == RBUG_OP_PING_REPLY);
+
+	shader_start_info_action(action->cid, action->sid, &action->iter,
+	                         RBUG_LANE_INTERACTIVE, p);
+
+	g_free(action);
+
+	return FALSE;
+}
+
+static void shader_start_edit_action(struct program *p)
+{
+	struct shader_action_edit *action;
+
+	action = g_malloc(sizeof(*action));
+	memset(action, 0, sizeof(*action));
+
+	action->e.func = shader_action_edit_fence;
+	action->cid = p->viewed.parent;
+	action->sid = p->viewed.id;
+	action->iter = p->viewed.iter;
+
+	rbug_fence(&action->e, p);
+}
+
 struct shader_action_list
 {
 	struct rbug_event e;
 
 	rbug_context_t ctx;
 
-	GtkTreeStore *store;
+	struct store *store;
 	GtkTreeIter parent;
 };
 
@@ -352,47 +414,48 @@ static gboolean shader_action_list_list(struct rbug_event *e,
 
 	struct rbug_proto_shader_list_reply *list;
 	struct shader_action_list *action;
-	GtkTreeStore *store;
 	GtkTreeIter *parent;
-	uint32_t i;
+	GHashTable *rows;
 
 	action = (struct shader_action_list *)e;
 	list = (struct rbug_proto_shader_list_reply *)header;
 	parent = &action->parent;
-	store = action->store;
 
-	for (i = 0; i < list->shaders_len; i++) {
-		GtkTreeIter iter;
-		gtk_tree_store_insert_with_values(store, &iter, parent, -1,
-		                                  COLUMN_ID, list->shaders[i],
-		                                  COLUMN_TYPE, TYPE_SHADER,
-		                                  COLUMN_TYPENAME, "shader",
-		                                  -1);
-
-		shader_start_info_action(action->ctx, list->shaders[i], &iter, p);
-	}
+	rows = main_sync_children(parent, TYPE_SHADER, list->shaders,
+	                          list->shaders_len, p);
+	main_add_children(parent, TYPE_SHADER, list->shaders,
+	                  list->shaders_len, rows, p);
 
+	g_hash_table_destroy(rows);
 	g_free(action);
 
 	return FALSE;
 }
 
-static void shader_start_list_action(GtkTreeStore *store, GtkTreeIter *parent,
+static int16_t shader_action_list_send(struct rbug_event *e,
+                                       uint32_t *serial,
+                                       struct program *p)
+{
+	struct shader_action_list *action = (struct shader_action_list *)e;
+
+	rbug_send_shader_list(p->rbug.con, action->ctx, serial);
+
+	return RBUG_OP_SHADER_LIST;
+}
+
+static void shader_start_list_action(struct store *store, GtkTreeIter *parent,
                                      rbug_context_t ctx, struct program *p)
 {
-	struct rbug_connection *con = p->rbug.con;
 	struct shader_action_list *action;
-	uint32_t serial = 0;
 
 	action = g_malloc(sizeof(*action));
 	memset(action, 0, sizeof(*action));
 
-	rbug_send_shader_list(con, ctx, &serial);
-
 	action->e.func = shader_action_list_list;
+	action->e.send = shader_action_list_send;
 	action->ctx = ctx;
 	action->store = store;
 	action->parent = *parent;
 
-	rbug_add_reply(&action->e, serial, p);
+	rbug_queue(&action->e, RBUG_LANE_BACKGROUND, p);
 }
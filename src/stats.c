@@ -0,0 +1,334 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Protocol statistics, per opcode counters and send to reply latency.
+ *
+ * Requests and their replies share a row, keyed by the request opcode.
+ * Latencies go into log linear histograms, each power of two is split
+ * into STATS_HALF buckets which keeps the error around three percent
+ * whatever the magnitude.
+ */
+
+#include "program.h"
+
+#include <stdio.h>
+
+#define STATS_OP_NUM 1024
+
+#define STATS_SUB_BITS 5
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_HALF (STATS_SUB / 2)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 2) * STATS_HALF)
+
+/* how often the panel is updated, in ms */
+#define STATS_PERIOD 1000
+
+struct stats_op
+{
+	guint64 sent;
+	guint64 sent_bytes;
+	guint64 received;
+	guint64 received_bytes;
+
+	/* latency in us, hist is NULL until the first reply */
+	guint64 replies;
+	guint64 max;
+	guint64 total;
+	guint32 *hist;
+};
+
+static unsigned stats_index(int op)
+{
+	unsigned i = ABS(op);
+
+	/* unknown ops all go in the noop row */
+	return i < STATS_OP_NUM ? i : 0;
+}
+
+static unsigned stats_bucket(guint64 v)
+{
+	unsigned e;
+
+	if (v < STATS_SUB)
+		return v;
+
+	e = g_bit_storage(v) - STATS_SUB_BITS;
+
+	return e * STATS_HALF + (unsigned)(v >> e);
+}
+
+/* highest value that falls into bucket */
+static guint64 stats_bucket_value(unsigned bucket)
+{
+	unsigned e;
+
+	if (bucket < STATS_SUB)
+		return bucket;
+
+	e = bucket / STATS_HALF - 1;
+
+	return (((guint64)(bucket - e * STATS_HALF) + 1) << e) - 1;
+}
+
+static guint64 stats_percentile(struct stats_op *s, double q)
+{
+	guint64 want = (guint64)(s->replies * q + 0.5);
+	guint64 seen = 0;
+	unsigned i;
+
+	if (!s->hist)
+		return 0;
+
+	if (want < 1)
+		want = 1;
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += s->hist[i];
+		if (seen >= want)
+			return MIN(stats_bucket_value(i), s->max);
+	}
+
+	return s->max;
+}
+
+static const char * stats_op_name(int op)
+{
+	switch (op) {
+	case RBUG_OP_NOOP: return "noop";
+	case RBUG_OP_PING: return "ping";
+	case RBUG_OP_ERROR: return "error";
+	case RBUG_OP_TEXTURE_LIST: return "texture_list";
+	case RBUG_OP_TEXTURE_INFO: return "texture_info";
+	case RBUG_OP_TEXTURE_WRITE: return "texture_write";
+	case RBUG_OP_TEXTURE_READ: return "texture_read";
+	case RBUG_OP_CONTEXT_LIST: return "context_list";
+	case RBUG_OP_CONTEXT_INFO: return "context_info";
+	case RBUG_OP_CONTEXT_DRAW_BLOCK: return "context_draw_block";
+	case RBUG_OP_CONTEXT_DRAW_STEP: return "context_draw_step";
+	case RBUG_OP_CONTEXT_DRAW_UNBLOCK: return "context_draw_unblock";
+	case RBUG_OP_CONTEXT_DRAW_RULE: return "context_draw_rule";
+	case RBUG_OP_CONTEXT_FLUSH: return "context_flush";
+	case RBUG_OP_CONTEXT_DRAW_BLOCKED: return "context_draw_blocked";
+	case RBUG_OP_SHADER_LIST: return "shader_list";
+	case RBUG_OP_SHADER_INFO: return "shader_info";
+	case RBUG_OP_SHADER_DISABLE: return "shader_disable";
+	case RBUG_OP_SHADER_REPLACE: return "shader_replace";
+	default: return NULL;
+	}
+}
+
+/**
+ * One line per opcode that has seen any traffic, with a header line.
+ */
+static GString * stats_format(struct program *p)
+{
+	GString *str = g_string_new(NULL);
+	struct stats_op s;
+	const char *name;
+	char buf[16];
+	unsigned i;
+
+	g_string_append_printf(str, "%-22s %8s %12s %8s %12s %8s %8s %8s %8s %8s\n",
+	                       "# op", "sent", "sent_bytes", "recv", "recv_bytes",
+	                       "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+
+	g_mutex_lock(&p->stats.lock);
+
+	for (i = 0; i < STATS_OP_NUM; i++) {
+		s = p->stats.ops[i];
+		if (!s.sent && !s.received)
+			continue;
+
+		name = stats_op_name(i);
+		if (!name) {
+			snprintf(buf, sizeof(buf), "op_%u", i);
+			name = buf;
+		}
+
+		g_string_append_printf(str, "%-22s %8" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT
+		                       " %8" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT
+		                       " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+		                       " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+		                       " %8" G_GUINT64_FORMAT "\n",
+		                       name, s.sent, s.sent_bytes, s.received, s.received_bytes,
+		                       s.replies ? s.total / s.replies : 0,
+		                       stats_percentile(&s, 0.50),
+		                       stats_percentile(&s, 0.90),
+		                       stats_percentile(&s, 0.99),
+		                       s.max);
+	}
+
+	g_mutex_unlock(&p->stats.lock);
+
+	return str;
+}
+
+static gboolean stats_update(gpointer data)
+{
+	struct program *p = (struct program *)data;
+	GtkTextBuffer *buffer;
+	GString *str;
+
+	str = stats_format(p);
+	buffer = gtk_text_view_get_buffer(p->stats.view);
+	gtk_text_buffer_set_text(buffer, str->str, str->len);
+	g_string_free(str, TRUE);
+
+	return true;
+}
+
+static void stats_toggled(GtkWidget *widget, struct program *p)
+{
+	(void)widget;
+
+	if (gtk_toggle_tool_button_get_active(GTK_TOGGLE_TOOL_BUTTON(p->tool.stats))) {
+		stats_update(p);
+		p->stats.timeout = g_timeout_add(STATS_PERIOD, stats_update, p);
+		gtk_widget_show(p->stats.panel);
+	} else {
+		g_source_remove(p->stats.timeout);
+		p->stats.timeout = 0;
+		gtk_widget_hide(p->stats.panel);
+	}
+}
+
+
+/*
+ * Exported
+ */
+
+
+void stats_init(struct program *p)
+{
+	g_mutex_init(&p->stats.lock);
+	p->stats.ops = g_malloc0(sizeof(*p->stats.ops) * STATS_OP_NUM);
+}
+
+void stats_fini(struct program *p)
+{
+	unsigned i;
+
+	if (p->stats.timeout)
+		g_source_remove(p->stats.timeout);
+
+	for (i = 0; i < STATS_OP_NUM; i++)
+		g_free(p->stats.ops[i].hist);
+
+	g_free(p->stats.ops);
+	g_mutex_clear(&p->stats.lock);
+}
+
+void stats_setup(GtkWidget *tool, GtkWidget *panel, GtkTextView *view, struct program *p)
+{
+	PangoFontDescription *font = pango_font_description_from_string("monospace");
+
+	p->tool.stats = tool;
+	p->stats.panel = panel;
+	p->stats.view = view;
+
+	gtk_widget_modify_font(GTK_WIDGET(view), font);
+	pango_font_description_free(font);
+
+	g_signal_connect(tool, "toggled", G_CALLBACK(stats_toggled), p);
+}
+
+/**
+ * A message was handed to the socket, called from the network thread.
+ */
+void stats_sent(int16_t op, size_t bytes, struct program *p)
+{
+	struct stats_op *s = &p->stats.ops[stats_index(op)];
+
+	g_mutex_lock(&p->stats.lock);
+	s->sent++;
+	s->sent_bytes += bytes;
+	g_mutex_unlock(&p->stats.lock);
+}
+
+/**
+ * A message was read from the socket, called from the network thread.
+ */
+void stats_received(int16_t op, size_t bytes, struct program *p)
+{
+	struct stats_op *s = &p->stats.ops[stats_index(op)];
+
+	g_mutex_lock(&p->stats.lock);
+	s->received++;
+	s->received_bytes += bytes;
+	g_mutex_unlock(&p->stats.lock);
+}
+
+/**
+ * A reply to a request of op arrived after us microseconds.
+ */
+void stats_latency(int16_t op, gint64 us, struct program *p)
+{
+	struct stats_op *s = &p->stats.ops[stats_index(op)];
+	guint64 v = us < 0 ? 0 : us;
+
+	g_mutex_lock(&p->stats.lock);
+
+	if (!s->hist)
+		s->hist = g_malloc0(sizeof(*s->hist) * STATS_BUCKETS);
+
+	s->hist[stats_bucket(v)]++;
+	s->replies++;
+	s->total += v;
+	s->max = MAX(s->max, v);
+
+	g_mutex_unlock(&p->stats.lock);
+}
+
+void stats_totals(guint64 *sent, guint64 *received, struct program *p)
+{
+	unsigned i;
+
+	*sent = 0;
+	*received = 0;
+
+	g_mutex_lock(&p->stats.lock);
+
+	for (i = 0; i < STATS_OP_NUM; i++) {
+		*sent += p->stats.ops[i].sent_bytes;
+		*received += p->stats.ops[i].received_bytes;
+	}
+
+	g_mutex_unlock(&p->stats.lock);
+}
+
+gboolean stats_dump(const char *filename, struct program *p)
+{
+	GString *str = stats_format(p);
+	gboolean ret;
+
+	ret = g_file_set_contents(filename, str->str, str->len, NULL);
+	if (!ret)
+		g_print("failed to write stats to %s\n", filename);
+
+	g_string_free(str, TRUE);
+
+	return ret;
+}
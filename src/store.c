@@ -0,0 +1,764 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+/*
+ * The model behind the object tree.
+ *
+ * A GtkTreeStore keeps a GValue per row and column, including the two
+ * info strings of every texture. With tens of thousands of objects that
+ * is most of the memory and time spent filling the tree. Here each field
+ * is an array indexed by row and the strings are made when a cell is
+ * drawn, see store_info_short. Rows are never moved in the arrays, so
+ * iters stay valid until their row is removed.
+ */
+
+#include "program.h"
+
+#include "pipe/p_format.h"
+#include "util/u_format.h"
+#undef CLAMP
+#include "util/u_inlines.h"
+#include "tgsi/tgsi_strings.h"
+
+#include <stdlib.h>
+
+#define STORE_TYPE (store_get_type())
+#define STORE(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), STORE_TYPE, Store))
+
+/* rows allocated up front, doubled when they run out */
+#define STORE_ROWS 1024
+
+#define STORE_ROW(iter) GPOINTER_TO_UINT((iter)->user_data)
+
+typedef struct store Store;
+typedef struct store_class StoreClass;
+
+struct store
+{
+	GObject object;
+
+	gint stamp;
+
+	/* while frozen no signals are emitted, see store_freeze */
+	gint frozen;
+
+	/* rows allocated and rows handed out, removed rows go on free */
+	guint num;
+	guint used;
+	GArray *free;
+
+	/* children of the root */
+	GArray *top;
+
+	/* one entry per row, type is TYPE_NONE for free rows */
+	guint64 *id;
+	guint8 *type;
+	guint8 *state;
+	GdkPixbuf **pixbuf;
+	gint *parent;
+	guint *pos;
+	GArray **children;
+	/* bumped when the row is freed, iters carry it in user_data2 */
+	guint *serial;
+
+	/* only set for textures that have their info */
+	guint16 *format;
+	guint8 *target;
+	guint8 *samples;
+	guint8 *last_level;
+	guint32 *width;
+	guint32 *height;
+	guint32 *depth;
+};
+
+struct store_class
+{
+	GObjectClass parent_class;
+};
+
+static const char *store_typenames[] = {
+	NULL,
+	"screen",
+	"context",
+	"texture",
+	"shader",
+};
+
+static void store_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(Store, store, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, store_tree_model_init))
+
+static void store_iter_set(Store *s, GtkTreeIter *iter, guint row)
+{
+	iter->stamp = s->stamp;
+	iter->user_data = GUINT_TO_POINTER(row);
+	iter->user_data2 = GUINT_TO_POINTER(s->serial[row]);
+	iter->user_data3 = NULL;
+}
+
+/**
+ * Replies can come in for rows removed since they were asked for, or
+ * from before the store was cleared. Those are dropped, even if the
+ * row has been handed out again since.
+ */
+static gboolean store_iter_valid(Store *s, GtkTreeIter *iter)
+{
+	guint row = STORE_ROW(iter);
+
+	return iter->stamp == s->stamp && row < s->used &&
+	       s->type[row] != TYPE_NONE &&
+	       s->serial[row] == GPOINTER_TO_UINT(iter->user_data2);
+}
+
+/**
+ * Rows sharing the parent of row, in order.
+ */
+static GArray * store_siblings(Store *s, guint row)
+{
+	if (s->parent[row] < 0)
+		return s->top;
+
+	return s->children[s->parent[row]];
+}
+
+static void store_grow(Store *s)
+{
+	if (s->used < s->num)
+		return;
+
+	s->num = s->num ? s->num * 2 : STORE_ROWS;
+
+	s->id = g_renew(guint64, s->id, s->num);
+	s->type = g_renew(guint8, s->type, s->num);
+	s->state = g_renew(guint8, s->state, s->num);
+	s->pixbuf = g_renew(GdkPixbuf *, s->pixbuf, s->num);
+	s->parent = g_renew(gint, s->parent, s->num);
+	s->pos = g_renew(guint, s->pos, s->num);
+	s->children = g_renew(GArray *, s->children, s->num);
+	s->serial = g_renew(guint, s->serial, s->num);
+
+	s->format = g_renew(guint16, s->format, s->num);
+	s->target = g_renew(guint8, s->target, s->num);
+	s->samples = g_renew(guint8, s->samples, s->num);
+	s->last_level = g_renew(guint8, s->last_level, s->num);
+	s->width = g_renew(guint32, s->width, s->num);
+	s->height = g_renew(guint32, s->height, s->num);
+	s->depth = g_renew(guint32, s->depth, s->num);
+}
+
+static guint store_alloc(Store *s)
+{
+	guint row;
+
+	if (s->free->len) {
+		row = g_array_index(s->free, guint, s->free->len - 1);
+		g_array_set_size(s->free, s->free->len - 1);
+	} else {
+		store_grow(s);
+		row = s->used++;
+		s->serial[row] = 0;
+	}
+
+	s->pixbuf[row] = NULL;
+	s->children[row] = NULL;
+	s->state[row] = INFO_NONE;
+	s->format[row] = 0;
+	s->target[row] = 0;
+	s->samples[row] = 0;
+	s->last_level[row] = 0;
+	s->width[row] = 0;
+	s->height[row] = 0;
+	s->depth[row] = 0;
+
+	return row;
+}
+
+/**
+ * Free row and everything below it, the row is left in its siblings.
+ */
+static void store_free_row(Store *s, guint row)
+{
+	GArray *children = s->children[row];
+	guint i;
+
+	if (children) {
+		for (i = 0; i < children->len; i++)
+			store_free_row(s, g_array_index(children, guint, i));
+		g_array_free(children, TRUE);
+	}
+
+	if (s->pixbuf[row])
+		g_object_unref(s->pixbuf[row]);
+
+	s->pixbuf[row] = NULL;
+	s->children[row] = NULL;
+	s->type[row] = TYPE_NONE;
+	s->serial[row]++;
+
+	g_array_append_val(s->free, row);
+}
+
+static void store_changed(Store *s, guint row)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(s);
+	GtkTreePath *path;
+	GtkTreeIter iter;
+
+	if (s->frozen)
+		return;
+
+	store_iter_set(s, &iter, row);
+	path = gtk_tree_model_get_path(model, &iter);
+	gtk_tree_model_row_changed(model, path, &iter);
+	gtk_tree_path_free(path);
+}
+
+static int store_compare_desc(const void *a, const void *b)
+{
+	guint pa = *(const guint *)a;
+	guint pb = *(const guint *)b;
+
+	return pa < pb ? 1 : pa > pb ? -1 : 0;
+}
+
+
+/*
+ * GtkTreeModel
+ */
+
+
+static GtkTreeModelFlags store_get_flags(GtkTreeModel *model)
+{
+	(void)model;
+
+	return GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint store_get_n_columns(GtkTreeModel *model)
+{
+	(void)model;
+
+	return COLUMN_NUM;
+}
+
+static GType store_get_column_type(GtkTreeModel *model, gint column)
+{
+	(void)model;
+
+	switch (column) {
+	case COLUMN_ID:
+		return G_TYPE_UINT64;
+	case COLUMN_TYPE:
+	case COLUMN_INFO_STATE:
+		return G_TYPE_INT;
+	case COLUMN_PIXBUF:
+		return GDK_TYPE_PIXBUF;
+	default:
+		return G_TYPE_STRING;
+	}
+}
+
+static gboolean store_get_iter(GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	Store *s = STORE(model);
+	gint *indices = gtk_tree_path_get_indices(path);
+	gint depth = gtk_tree_path_get_depth(path);
+	GArray *siblings = s->top;
+	guint row = 0;
+	gint i;
+
+	if (depth < 1)
+		return FALSE;
+
+	for (i = 0; i < depth; i++) {
+		if (!siblings || indices[i] < 0 || (guint)indices[i] >= siblings->len)
+			return FALSE;
+
+		row = g_array_index(siblings, guint, indices[i]);
+		siblings = s->children[row];
+	}
+
+	store_iter_set(s, iter, row);
+
+	return TRUE;
+}
+
+static GtkTreePath * store_get_path(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	Store *s = STORE(model);
+	GtkTreePath *path = gtk_tree_path_new();
+	gint row = STORE_ROW(iter);
+
+	g_return_val_if_fail(iter->stamp == s->stamp, path);
+
+	for (; row >= 0; row = s->parent[row])
+		gtk_tree_path_prepend_index(path, s->pos[row]);
+
+	return path;
+}
+
+static void store_get_value(GtkTreeModel *model, GtkTreeIter *iter,
+                            gint column, GValue *value)
+{
+	Store *s = STORE(model);
+	guint row = STORE_ROW(iter);
+	char text[128];
+
+	g_return_if_fail(iter->stamp == s->stamp);
+
+	g_value_init(value, store_get_column_type(model, column));
+
+	switch (column) {
+	case COLUMN_ID:
+		g_value_set_uint64(value, s->id[row]);
+		break;
+	case COLUMN_TYPE:
+		g_value_set_int(value, s->type[row]);
+		break;
+	case COLUMN_TYPENAME:
+		g_value_set_static_string(value, store_typenames[s->type[row]]);
+		break;
+	case COLUMN_PIXBUF:
+		g_value_set_object(value, s->pixbuf[row]);
+		break;
+	case COLUMN_INFO_SHORT:
+		if (store_info_short(s, iter, text, sizeof(text)))
+			g_value_set_string(value, text);
+		break;
+	case COLUMN_INFO_LONG:
+		if (store_info_long(s, iter, text, sizeof(text)))
+			g_value_set_string(value, text);
+		break;
+	case COLUMN_INFO_STATE:
+		g_value_set_int(value, s->state[row]);
+		break;
+	}
+}
+
+static gboolean store_iter_next(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	Store *s = STORE(model);
+	guint row = STORE_ROW(iter);
+	GArray *siblings = store_siblings(s, row);
+
+	if (s->pos[row] + 1 >= siblings->len)
+		return FALSE;
+
+	store_iter_set(s, iter, g_array_index(siblings, guint, s->pos[row] + 1));
+
+	return TRUE;
+}
+
+static gboolean store_iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter,
+                                     GtkTreeIter *parent, gint n)
+{
+	Store *s = STORE(model);
+	GArray *children;
+
+	children = parent ? s->children[STORE_ROW(parent)] : s->top;
+	if (!children || n < 0 || (guint)n >= children->len)
+		return FALSE;
+
+	store_iter_set(s, iter, g_array_index(children, guint, n));
+
+	return TRUE;
+}
+
+static gboolean store_iter_children(GtkTreeModel *model, GtkTreeIter *iter,
+                                    GtkTreeIter *parent)
+{
+	return store_iter_nth_child(model, iter, parent, 0);
+}
+
+static gboolean store_iter_has_child(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	Store *s = STORE(model);
+	GArray *children = s->children[STORE_ROW(iter)];
+
+	return children && children->len;
+}
+
+static gint store_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	Store *s = STORE(model);
+	GArray *children;
+
+	children = iter ? s->children[STORE_ROW(iter)] : s->top;
+
+	return children ? (gint)children->len : 0;
+}
+
+static gboolean store_iter_parent(GtkTreeModel *model, GtkTreeIter *iter,
+                                  GtkTreeIter *child)
+{
+	Store *s = STORE(model);
+	gint parent = s->parent[STORE_ROW(child)];
+
+	if (parent < 0)
+		return FALSE;
+
+	store_iter_set(s, iter, parent);
+
+	return TRUE;
+}
+
+static void store_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = store_get_flags;
+	iface->get_n_columns = store_get_n_columns;
+	iface->get_column_type = store_get_column_type;
+	iface->get_iter = store_get_iter;
+	iface->get_path = store_get_path;
+	iface->get_value = store_get_value;
+	iface->iter_next = store_iter_next;
+	iface->iter_children = store_iter_children;
+	iface->iter_has_child = store_iter_has_child;
+	iface->iter_n_children = store_iter_n_children;
+	iface->iter_nth_child = store_iter_nth_child;
+	iface->iter_parent = store_iter_parent;
+}
+
+
+/*
+ * GObject
+ */
+
+
+static void store_init(Store *s)
+{
+	s->stamp = g_random_int();
+	s->free = g_array_new(FALSE, FALSE, sizeof(guint));
+	s->top = g_array_new(FALSE, FALSE, sizeof(guint));
+}
+
+static void store_finalize(GObject *object)
+{
+	Store *s = STORE(object);
+	guint i;
+
+	for (i = 0; i < s->top->len; i++)
+		store_free_row(s, g_array_index(s->top, guint, i));
+
+	g_array_free(s->free, TRUE);
+	g_array_free(s->top, TRUE);
+
+	g_free(s->id);
+	g_free(s->type);
+	g_free(s->state);
+	g_free(s->pixbuf);
+	g_free(s->parent);
+	g_free(s->pos);
+	g_free(s->children);
+	g_free(s->serial);
+
+	g_free(s->format);
+	g_free(s->target);
+	g_free(s->samples);
+	g_free(s->last_level);
+	g_free(s->width);
+	g_free(s->height);
+	g_free(s->depth);
+
+	G_OBJECT_CLASS(store_parent_class)->finalize(object);
+}
+
+static void store_class_init(StoreClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = store_finalize;
+}
+
+
+/*
+ * Exported
+ */
+
+
+struct store * store_new(void)
+{
+	return g_object_new(STORE_TYPE, NULL);
+}
+
+/**
+ * Stop emitting signals for changes to the model, for adding many rows
+ * while it is not set on any view. Only appends may be made while
+ * frozen, those do not move any row a GtkTreeRowReference points to.
+ */
+void store_freeze(struct store *s)
+{
+	s->frozen++;
+}
+
+void store_thaw(struct store *s)
+{
+	g_assert(s->frozen > 0);
+
+	s->frozen--;
+}
+
+void store_clear(struct store *s)
+{
+	GtkTreePath *path;
+	guint i;
+
+	for (i = s->top->len; i > 0; i--) {
+		store_free_row(s, g_array_index(s->top, guint, i - 1));
+		g_array_set_size(s->top, i - 1);
+
+		if (s->frozen)
+			continue;
+
+		path = gtk_tree_path_new();
+		gtk_tree_path_append_index(path, i - 1);
+		gtk_tree_model_row_deleted(GTK_TREE_MODEL(s), path);
+		gtk_tree_path_free(path);
+	}
+
+	/* old iters are no longer valid */
+	g_array_set_size(s->free, 0);
+	s->used = 0;
+	s->stamp++;
+}
+
+void store_append(struct store *s, GtkTreeIter *iter, GtkTreeIter *parent,
+                  guint64 id, enum types type)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(s);
+	GArray *siblings;
+	GtkTreePath *path;
+	guint row;
+
+	row = store_alloc(s);
+
+	if (parent) {
+		s->parent[row] = STORE_ROW(parent);
+		if (!s->children[s->parent[row]])
+			s->children[s->parent[row]] = g_array_new(FALSE, FALSE, sizeof(guint));
+		siblings = s->children[s->parent[row]];
+	} else {
+		s->parent[row] = -1;
+		siblings = s->top;
+	}
+
+	s->id[row] = id;
+	s->type[row] = type;
+	s->pos[row] = siblings->len;
+	g_array_append_val(siblings, row);
+
+	store_iter_set(s, iter, row);
+
+	if (s->frozen)
+		return;
+
+	path = gtk_tree_model_get_path(model, iter);
+	gtk_tree_model_row_inserted(model, path, iter);
+	gtk_tree_path_free(path);
+
+	if (parent && siblings->len == 1) {
+		path = gtk_tree_model_get_path(model, parent);
+		gtk_tree_model_row_has_child_toggled(model, path, parent);
+		gtk_tree_path_free(path);
+	}
+}
+
+/**
+ * Remove num rows, all children of parent, and everything below them.
+ * The siblings left are moved up in one go rather than once per row.
+ */
+void store_remove_rows(struct store *s, GtkTreeIter *parent,
+                       const GtkTreeIter *iters, unsigned num)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(s);
+	GtkTreePath *path;
+	GArray *siblings;
+	guint *removed;
+	guint row;
+	guint i, j;
+
+	if (!num)
+		return;
+
+	siblings = parent ? s->children[STORE_ROW(parent)] : s->top;
+	removed = g_malloc(sizeof(*removed) * num);
+
+	for (i = 0; i < num; i++) {
+		row = STORE_ROW(&iters[i]);
+		removed[i] = s->pos[row];
+		store_free_row(s, row);
+	}
+
+	for (i = 0, j = 0; i < siblings->len; i++) {
+		row = g_array_index(siblings, guint, i);
+		if (s->type[row] == TYPE_NONE)
+			continue;
+
+		s->pos[row] = j;
+		g_array_index(siblings, guint, j++) = row;
+	}
+	g_array_set_size(siblings, j);
+
+	if (!s->frozen) {
+		/* last first, so every path is right when it is deleted */
+		qsort(removed, num, sizeof(*removed), store_compare_desc);
+
+		path = parent ? gtk_tree_model_get_path(model, parent) : gtk_tree_path_new();
+		for (i = 0; i < num; i++) {
+			gtk_tree_path_append_index(path, removed[i]);
+			gtk_tree_model_row_deleted(model, path);
+			gtk_tree_path_up(path);
+		}
+
+		if (parent && !siblings->len)
+			gtk_tree_model_row_has_child_toggled(model, path, parent);
+
+		gtk_tree_path_free(path);
+	}
+
+	g_free(removed);
+}
+
+void store_set_pixbuf(struct store *s, GtkTreeIter *iter, GdkPixbuf *pixbuf)
+{
+	guint row = STORE_ROW(iter);
+
+	if (!store_iter_valid(s, iter) || s->pixbuf[row] == pixbuf)
+		return;
+
+	if (pixbuf)
+		g_object_ref(pixbuf);
+	if (s->pixbuf[row])
+		g_object_unref(s->pixbuf[row]);
+	s->pixbuf[row] = pixbuf;
+
+	store_changed(s, row);
+}
+
+/**
+ * Not shown, so no row-changed is emitted.
+ */
+void store_set_state(struct store *s, GtkTreeIter *iter, enum info_state state)
+{
+	if (!store_iter_valid(s, iter))
+		return;
+
+	s->state[STORE_ROW(iter)] = state;
+}
+
+/**
+ * Info of every row is out of date, it is fetched again as rows come
+ * into view. Also not shown, see store_set_state.
+ */
+void store_reset_state(struct store *s)
+{
+	guint row;
+
+	for (row = 0; row < s->used; row++)
+		if (s->state[row] == INFO_DONE)
+			s->state[row] = INFO_NONE;
+}
+
+void store_set_texture(struct store *s, GtkTreeIter *iter,
+                       const struct rbug_proto_texture_info_reply *info,
+                       GdkPixbuf *pixbuf)
+{
+	guint row = STORE_ROW(iter);
+
+	if (!store_iter_valid(s, iter))
+		return;
+
+	s->format[row] = info->format;
+	s->target[row] = info->target;
+	s->samples[row] = info->nr_samples;
+	s->last_level[row] = info->last_level;
+	s->width[row] = info->width[0];
+	s->height[row] = info->height[0];
+	s->depth[row] = info->depth[0];
+	s->state[row] = INFO_DONE;
+
+	if (pixbuf)
+		g_object_ref(pixbuf);
+	if (s->pixbuf[row])
+		g_object_unref(s->pixbuf[row]);
+	s->pixbuf[row] = pixbuf;
+
+	store_changed(s, row);
+}
+
+guint64 store_id(struct store *s, GtkTreeIter *iter)
+{
+	return s->id[STORE_ROW(iter)];
+}
+
+const char * store_typename(struct store *s, GtkTreeIter *iter)
+{
+	return store_typenames[s->type[STORE_ROW(iter)]];
+}
+
+/**
+ * Text for the info column, FALSE for rows that have none.
+ */
+gboolean store_info_short(struct store *s, GtkTreeIter *iter, char *buf, size_t size)
+{
+	guint row = STORE_ROW(iter);
+
+	if (s->type[row] != TYPE_TEXTURE)
+		return FALSE;
+
+	if (s->state[row] != INFO_DONE) {
+		snprintf(buf, size, "(?x?x?) ?");
+		return TRUE;
+	}
+
+	snprintf(buf, size, "%s, %ux%ux%u, %s",
+	         tgsi_texture_names[util_pipe_tex_to_tgsi_tex(s->target[row], s->samples[row])],
+	         s->width[row], s->height[row], s->depth[row],
+	         util_format_name(s->format[row]) + 12);
+
+	return TRUE;
+}
+
+/**
+ * Text for the statusbar, FALSE for rows that have none.
+ */
+gboolean store_info_long(struct store *s, GtkTreeIter *iter, char *buf, size_t size)
+{
+	guint row = STORE_ROW(iter);
+
+	if (s->type[row] != TYPE_TEXTURE)
+		return FALSE;
+
+	if (s->state[row] != INFO_DONE) {
+		snprintf(buf, size, "PIPE_FORMAT_UNKNOWN (?x?x?) ?");
+		return TRUE;
+	}
+
+	snprintf(buf, size, "%s (%ux%ux%u) %u",
+	         util_format_name(s->format[row]),
+	         s->width[row], s->height[row], s->depth[row],
+	         s->last_level[row]);
+
+	return TRUE;
+}
@@ -24,18 +24,70 @@
 
 #include "program.h"
 
+#define GL_GLEXT_PROTOTYPES
 #include "GL/gl.h"
 
 #include "pipe/p_format.h"
 #include "util/u_format.h"
 #undef CLAMP
 #include "util/u_inlines.h"
-#include "tgsi/tgsi_strings.h"
 
 /* needed for u_tile */
 #include "pipe/p_state.h"
 #include "util/u_tile.h"
 
+/*
+ * Levels with more than TEXTURE_TILED_MIN texels are not downloaded
+ * whole, only the TEXTURE_TILE sized tiles that are on screen are read
+ * and cached, more are read as the view is panned and zoomed.
+ */
+#define TEXTURE_TILE 256
+#define TEXTURE_TILED_MIN (2048 * 2048)
+
+/* tile numbers are 1 based, 0 is the whole level in the cache */
+#define TEXTURE_TILE_NUM(tx, ty) ((((guint)(ty) << 16) | (guint)(tx)) + 1)
+
+/* p->texture.tiles_pending key, tile numbers stay below 1 << 27 */
+#define TEXTURE_TILE_KEY(level, tile) GUINT_TO_POINTER((guint)(tile) | ((guint)(level) << 27))
+
+/*
+ * Zoomed out the tiles are read from the smallest level that still has a
+ * texel per screen pixel, and a view never reads more tiles than fit in
+ * half the cache budget, counted as float RGBA, the largest they upload
+ * as. Otherwise the tiles of one view would evict each other forever.
+ */
+#define TEXTURE_TILE_BYTES (TEXTURE_TILE * TEXTURE_TILE * 16)
+
+#define TEXTURE_ZOOM_MIN (1.0f / 64)
+#define TEXTURE_ZOOM_MAX 32.0f
+
+/*
+ * Levels that have to be converted before upload are split in bands of
+ * rows that are converted on p->texture.pool, the upload happens once
+ * the last band is done. Levels with fewer rows are converted in place.
+ */
+#define TEXTURE_BAND 64
+
+/*
+ * Read data is hashed in TEXTURE_DIRTY sized tiles, when a level is read
+ * again only the tiles whose hash changed are converted and uploaded.
+ * The same height as the bands so unchanged bands are skipped whole.
+ */
+#define TEXTURE_DIRTY TEXTURE_BAND
+
+#define TEXTURE_HASH_PRIME1 11400714785074694791ull
+#define TEXTURE_HASH_PRIME2 14029467366897019727ull
+#define TEXTURE_HASH_PRIME3 1609587929392839161ull
+
+/*
+ * With Auto the viewed texture is read again p->texture.auto_rate times a
+ * second. While a read is still outstanding when the next one is due the
+ * wait is doubled, up to TEXTURE_AUTO_MAX ms, and halved back once reads
+ * keep up. Nothing is read while the view is hidden, or while every
+ * context is blocked and nothing was stepped or flushed since the last.
+ */
+#define TEXTURE_AUTO_MAX 2000
+
 enum {
 	BACK_MIN = 0,
 	BACK_CHECKER = 0,
@@ -57,10 +109,22 @@ static void texture_start_if_new_read_action(rbug_texture_t t,
                                              struct program *p);
 static struct texture_action_read *
 texture_start_read_action(rbug_texture_t t,
+                          unsigned level,
                           GtkTreeIter *iter,
+                          enum rbug_lane lane,
                           struct program *p);
+static void texture_start_prefetch_action(rbug_texture_t t,
+                                          unsigned level,
+                                          unsigned layer,
+                                          struct program *p);
+static void texture_start_tile_action(unsigned level, unsigned tx, unsigned ty,
+                                      struct program *p);
+static void texture_drop_tiles(struct program *p);
 
-static void texture_start_list_action(GtkTreeStore *store,
+static void texture_start_row_action(GtkTreeIter *iter,
+                                     rbug_texture_t id,
+                                     struct program *p);
+static void texture_start_list_action(struct store *store,
                                       GtkTreeIter *parent,
                                       struct program *p);
 
@@ -70,6 +134,86 @@ static void texture_start_list_action(GtkTreeStore *store,
  */
 
 
+static gboolean texture_auto_tick(gpointer data);
+
+static guint texture_auto_period(struct program *p)
+{
+	return 1000 / MAX(p->texture.auto_rate, 1);
+}
+
+static void texture_auto_schedule(guint delay, struct program *p)
+{
+	if (p->texture.auto_timer)
+		g_source_remove(p->texture.auto_timer);
+
+	p->texture.auto_delay = delay;
+	p->texture.auto_timer = g_timeout_add(delay, texture_auto_tick, p);
+}
+
+static void texture_auto_stop(struct program *p)
+{
+	if (p->texture.auto_timer)
+		g_source_remove(p->texture.auto_timer);
+	p->texture.auto_timer = 0;
+}
+
+static gboolean texture_auto_visible(struct program *p)
+{
+	GdkWindowState hidden = GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN;
+	GdkWindow *window = gtk_widget_get_window(p->main.window);
+
+	if (!window || (gdk_window_get_state(window) & hidden))
+		return FALSE;
+
+	return gtk_widget_get_mapped(GTK_WIDGET(p->main.draw));
+}
+
+static gboolean texture_auto_tick(gpointer data)
+{
+	struct program *p = (struct program *)data;
+	guint period = texture_auto_period(p);
+	guint delay = MAX(p->texture.auto_delay, period);
+	gboolean busy;
+
+	p->texture.auto_timer = 0;
+
+	if (!p->texture.automatic)
+		return FALSE;
+
+	/* paused, just look again in a while */
+	if (!texture_auto_visible(p)) {
+		texture_auto_schedule(TEXTURE_AUTO_MAX, p);
+		return FALSE;
+	}
+
+	if (p->texture.tiled)
+		busy = g_hash_table_size(p->texture.tiles_pending) != 0;
+	else
+		busy = p->texture.read != NULL;
+
+	/* reads take longer than the period, back off */
+	if (busy) {
+		texture_auto_schedule(MIN(delay * 2, TEXTURE_AUTO_MAX), p);
+		return FALSE;
+	}
+
+	delay = MAX(delay / 2, period);
+
+	/* nothing can have changed */
+	if (context_all_blocked(p) && p->texture.auto_generation == p->cache.generation) {
+		texture_auto_schedule(delay, p);
+		return FALSE;
+	}
+
+	p->texture.auto_generation = p->cache.generation;
+	texture_refresh(p);
+
+	texture_auto_schedule(delay, p);
+
+	return FALSE;
+}
+
+
 static void alpha(GtkWidget *widget, struct program *p)
 {
 	(void)widget;
@@ -85,8 +229,14 @@ static void automatic(GtkWidget *widget, struct program *p)
 
 	p->texture.automatic = !p->texture.automatic;
 
-	if (p->texture.automatic)
-		texture_start_if_new_read_action(p->viewed.id, &p->viewed.iter, p);
+	if (!p->texture.automatic) {
+		texture_auto_stop(p);
+		return;
+	}
+
+	p->texture.auto_generation = p->cache.generation;
+	texture_start_if_new_read_action(p->viewed.id, &p->viewed.iter, p);
+	texture_auto_schedule(texture_auto_period(p), p);
 }
 
 static void background(GtkWidget *widget, struct program *p)
@@ -100,11 +250,235 @@ static void background(GtkWidget *widget, struct program *p)
 	gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
 }
 
+static gboolean texture_is_tiled(unsigned width, unsigned height)
+{
+	return (guint64)width * height > TEXTURE_TILED_MIN;
+}
+
+static void texture_use(struct cache_texture *t, struct program *p)
+{
+	texture_drop_tiles(p);
+
+	p->texture.id = t->id;
+	p->texture.tex = t->tex;
+	p->texture.width = t->width;
+	p->texture.height = t->height;
+	p->texture.tiled = FALSE;
+}
+
+/* show level of the texture from its last info in tiles */
+static void texture_use_tiled(unsigned level, unsigned layer, struct program *p)
+{
+	/* tiles still coming in are for something else now */
+	if (!p->texture.tiled || p->texture.id != p->texture.info_id ||
+	    p->texture.level != level || p->texture.layer != layer)
+		texture_drop_tiles(p);
+
+	p->texture.id = p->texture.info_id;
+	p->texture.tex = 0;
+	p->texture.width = p->texture.levels[level].width;
+	p->texture.height = p->texture.levels[level].height;
+	p->texture.tiled = TRUE;
+	p->texture.level = level;
+	p->texture.layer = layer;
+
+	gtk_spin_button_set_range(p->main.layer, 0, p->texture.depth - 1);
+
+	gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
+}
+
+/* show the viewed texture from the cache, or download it */
+static void texture_show(struct program *p)
+{
+	struct cache_texture *t;
+	unsigned level;
+	unsigned layer;
+
+	level = gtk_spin_button_get_value_as_int(p->main.level);
+	layer = gtk_spin_button_get_value_as_int(p->main.layer);
+
+	/* size is known already, no need to ask again */
+	if (p->texture.info_id == p->viewed.id && level < p->texture.num_levels &&
+	    texture_is_tiled(p->texture.levels[level].width, p->texture.levels[level].height)) {
+		if (p->texture.read)
+			texture_stop_read_action(p->texture.read, p);
+
+		texture_use_tiled(level, layer, p);
+		return;
+	}
+
+	t = cache_get(p->viewed.id, level, layer, 0, p);
+
+	if (!t) {
+		texture_start_if_new_read_action(p->viewed.id, &p->viewed.iter, p);
+		return;
+	}
+
+	if (p->texture.read)
+		texture_stop_read_action(p->texture.read, p);
+
+	texture_use(t, p);
+	gtk_spin_button_set_range(p->main.layer, 0, t->depth - 1);
+	gtk_spin_button_set_range(p->main.level, 0, t->levels - 1);
+
+	gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
+}
+
 static void layer_changed(GtkWidget *widget, struct program *p)
 {
 	(void)widget;
 
-	texture_start_if_new_read_action(p->viewed.id, &p->viewed.iter, p);
+	texture_show(p);
+}
+
+static void level_changed(GtkWidget *widget, struct program *p)
+{
+	(void)widget;
+
+	texture_show(p);
+}
+
+/* prefetch the levels next to the one just downloaded */
+static void texture_prefetch(rbug_texture_t t, unsigned level, unsigned layer,
+                             struct program *p)
+{
+	unsigned l;
+
+	if (p->texture.info_id != t)
+		return;
+
+	for (l = level ? level - 1 : 0; l <= level + 1 && l < p->texture.num_levels; l++) {
+		if (l == level)
+			continue;
+
+		/* too big to read whole */
+		if (texture_is_tiled(p->texture.levels[l].width, p->texture.levels[l].height))
+			continue;
+
+		if (!cache_get(t, l, layer, 0, p))
+			texture_start_prefetch_action(t, l, layer, p);
+	}
+}
+
+static void texture_quad(float x, float y, float w, float h)
+{
+	glBegin(GL_QUADS);
+	glTexCoord2f(    0,     1);
+	glVertex2f  (x    , y + h);
+	glTexCoord2f(    1,     1);
+	glVertex2f  (x + w, y + h);
+	glTexCoord2f(    1,     0);
+	glVertex2f  (x + w, y    );
+	glTexCoord2f(    0,     0);
+	glVertex2f  (x    , y    );
+	glEnd();
+}
+
+/* the other levels already downloaded, right of the texture */
+static void texture_draw_strip(uint32_t x, struct program *p)
+{
+	struct cache_texture *t;
+	unsigned level;
+	unsigned layer;
+	unsigned i;
+	uint32_t y = 0;
+
+	level = gtk_spin_button_get_value_as_int(p->main.level);
+	layer = gtk_spin_button_get_value_as_int(p->main.layer);
+
+	for (i = 0; i < G_N_ELEMENTS(p->texture.levels); i++) {
+		if (i == level)
+			continue;
+
+		t = cache_get(p->texture.id, i, layer, 0, p);
+		if (!t)
+			continue;
+
+		glBindTexture(GL_TEXTURE_2D, t->tex);
+		texture_quad(x, y, t->width, t->height);
+
+		y += t->height + 10;
+	}
+}
+
+/* draw the tiles on screen, reading the ones missing */
+static void texture_draw_tiles(struct program *p)
+{
+	struct cache_texture *t;
+	float zoom = p->texture.zoom;
+	unsigned level = p->texture.level;
+	unsigned width, height;
+	unsigned num, max;
+	float sx, sy;
+	int x0, y0, x1, y1;
+	int tx, ty;
+	guint tile;
+
+	/* see TEXTURE_TILE_BYTES */
+	while (zoom * 2 <= 1.0f && level + 1 < p->texture.num_levels) {
+		level++;
+		zoom *= 2;
+	}
+
+	/* zoomed in or out past another level, what is queued is not needed */
+	if (level != p->texture.tiles_level) {
+		texture_drop_tiles(p);
+		p->texture.tiles_level = level;
+	}
+
+	width = p->texture.levels[level].width;
+	height = p->texture.levels[level].height;
+	sx = (float)width / p->texture.width;
+	sy = (float)height / p->texture.height;
+	max = MAX((size_t)p->cache.budget * 1024 * 1024 / 2 / TEXTURE_TILE_BYTES, 1);
+
+	/* draw in texels of that level */
+	glPushMatrix();
+	glScalef(1 / sx, 1 / sy, 1);
+
+	/* small enough to have been read whole, by a prefetch say */
+	if (level != p->texture.level && !texture_is_tiled(width, height)) {
+		t = cache_get(p->texture.id, level, p->texture.layer, 0, p);
+		if (t) {
+			glBindTexture(GL_TEXTURE_2D, t->tex);
+			texture_quad(0, 0, t->width, t->height);
+			glPopMatrix();
+			return;
+		}
+	}
+
+	/* visible texels */
+	x0 = MAX((int)(p->texture.pan_x * sx), 0);
+	y0 = MAX((int)(p->texture.pan_y * sy), 0);
+	x1 = MIN((int)(p->texture.pan_x * sx + p->draw.width / zoom) + 1, (int)width);
+	y1 = MIN((int)(p->texture.pan_y * sy + p->draw.height / zoom) + 1, (int)height);
+
+	p->texture.tiles_draws++;
+
+	num = 0;
+	for (ty = y0 / TEXTURE_TILE; ty * TEXTURE_TILE < y1; ty++) {
+		for (tx = x0 / TEXTURE_TILE; tx * TEXTURE_TILE < x1; tx++) {
+			tile = TEXTURE_TILE_NUM(tx, ty);
+			t = cache_get(p->texture.id, level, p->texture.layer, tile, p);
+
+			/* a stale tile stays up until the read replacing it is in */
+			if (!t) {
+				if (num < max &&
+				    g_hash_table_size(p->texture.tiles_pending) < max)
+					texture_start_tile_action(level, tx, ty, p);
+				t = cache_find(p->texture.id, level, p->texture.layer, tile, p);
+			}
+
+			num++;
+			if (!t)
+				continue;
+
+			glBindTexture(GL_TEXTURE_2D, t->tex);
+			texture_quad(tx * TEXTURE_TILE, ty * TEXTURE_TILE, t->width, t->height);
+		}
+	}
+
+	glPopMatrix();
 }
 
 /*
@@ -112,13 +486,62 @@ static void layer_changed(GtkWidget *widget, struct program *p)
  */
 
 
-void texture_list(GtkTreeStore *store, GtkTreeIter *parent, struct program *p)
+/**
+ * Move the view by dx, dy pixels on screen.
+ */
+void texture_pan(double dx, double dy, struct program *p)
+{
+	p->texture.pan_x -= dx / p->texture.zoom;
+	p->texture.pan_y -= dy / p->texture.zoom;
+
+	gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
+}
+
+/**
+ * Zoom in or out by factor keeping the texel under x, y in place.
+ */
+void texture_zoom(double factor, double x, double y, struct program *p)
+{
+	float zoom = p->texture.zoom * factor;
+
+	zoom = MIN(MAX(zoom, TEXTURE_ZOOM_MIN), TEXTURE_ZOOM_MAX);
+
+	x -= 10;
+	y -= 10;
+
+	p->texture.pan_x += x / p->texture.zoom - x / zoom;
+	p->texture.pan_y += y / p->texture.zoom - y / zoom;
+	p->texture.zoom = zoom;
+
+	gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
+}
+
+void texture_list(struct store *store, GtkTreeIter *parent, struct program *p)
 {
 	texture_start_list_action(store, parent, p);
 }
 
+/**
+ * Fetch the info of a listed texture that came into view.
+ */
+void texture_row_visible(GtkTreeIter *iter, rbug_texture_t id, struct program *p)
+{
+	store_set_state(p->main.store, iter, INFO_PENDING);
+
+	texture_start_row_action(iter, id, p);
+}
+
 void texture_refresh(struct program *p)
 {
+	/* read the tiles on screen again */
+	if (p->texture.tiled && p->texture.id == p->viewed.id) {
+		p->texture.dirty_changed = 0;
+		p->texture.dirty_tiles = 0;
+		cache_invalidate_texture(p->texture.id, p);
+		gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
+		return;
+	}
+
 	texture_start_if_new_read_action(p->viewed.id, &p->viewed.iter, p);
 }
 
@@ -156,23 +579,31 @@ void texture_draw(struct program *p)
 		glEnable(GL_BLEND);
 	glEnable(GL_TEXTURE_2D);
 
+	glTranslatef(10, 10, 0);
+	glScalef(p->texture.zoom, p->texture.zoom, 1);
+	glTranslatef(-p->texture.pan_x, -p->texture.pan_y, 0);
+
 	glColor3f(1.0, 1.0, 1.0);
-	glBegin(GL_QUADS);
-	glTexCoord2f(     0,      1);
-	glVertex2f  (10    , 10 + h);
-	glTexCoord2f(     1,      1);
-	glVertex2f  (10 + w, 10 + h);
-	glTexCoord2f(     1,      0);
-	glVertex2f  (10 + w, 10    );
-	glTexCoord2f(     0,      0);
-	glVertex2f  (10    , 10    );
-	glEnd();
-	
+	if (p->texture.tiled) {
+		texture_draw_tiles(p);
+	} else {
+		glBindTexture(GL_TEXTURE_2D, p->texture.tex);
+		texture_quad(0, 0, w, h);
+		texture_draw_strip(w + 10, p);
+	}
+
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_BLEND);
+}
 
-	if (p->texture.automatic)
-		texture_start_if_new_read_action(p->viewed.id, &p->viewed.iter, p);
+/**
+ * Wait for conversions already running, the rest are dropped.
+ */
+void texture_fini(struct program *p)
+{
+	if (p->texture.pool)
+		g_thread_pool_free(p->texture.pool, TRUE, TRUE);
+	p->texture.pool = NULL;
 }
 
 void texture_unviewed(struct program *p)
@@ -186,18 +617,32 @@ void texture_unviewed(struct program *p)
 
 	p->texture.automatic = FALSE;
 	p->texture.back = BACK_CHECKER;
+	texture_auto_stop(p);
+
+	gtk_statusbar_pop(p->main.statusbar,
+	                  gtk_statusbar_get_context_id(p->main.statusbar, "changes"));
 
 	g_signal_handler_disconnect(p->tool.alpha, p->texture.tid[0]);
 	g_signal_handler_disconnect(p->tool.automatic, p->texture.tid[1]);
 	g_signal_handler_disconnect(p->tool.background, p->texture.tid[2]);
 	g_signal_handler_disconnect(p->main.layer, p->texture.tid[3]);
+	g_signal_handler_disconnect(p->main.level, p->texture.tid[4]);
 }
 
 void texture_viewed(struct program *p)
 {
 	g_assert(p->viewed.type == TYPE_TEXTURE);
 
-	texture_start_if_new_read_action(p->viewed.id, &p->viewed.iter, p);
+	if (!p->texture.tiles_pending)
+		p->texture.tiles_pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* start out at the full size */
+	gtk_spin_button_set_value(p->main.level, 0);
+	p->texture.pan_x = 0;
+	p->texture.pan_y = 0;
+	p->texture.zoom = 1;
+
+	texture_show(p);
 
 	gtk_widget_show(p->tool.alpha);
 	gtk_widget_show(p->tool.automatic);
@@ -213,6 +658,7 @@ void texture_viewed(struct program *p)
 	p->texture.tid[1] = g_signal_connect(p->tool.automatic, "clicked", G_CALLBACK(automatic), p);
 	p->texture.tid[2] = g_signal_connect(p->tool.background, "clicked", G_CALLBACK(background), p);
 	p->texture.tid[3] = g_signal_connect(p->main.layer, "value-changed", G_CALLBACK(layer_changed), p);
+	p->texture.tid[4] = g_signal_connect(p->main.level, "value-changed", G_CALLBACK(level_changed), p);
 }
 
 void texture_unselected(struct program *p)
@@ -234,19 +680,50 @@ struct texture_action_read
 	struct rbug_event e;
 
 	rbug_texture_t id;
+	unsigned level;
 	unsigned layer;
 
 	GtkTreeIter iter;
+	enum rbug_lane lane;
 
 	gboolean running;
 	gboolean pending;
+	/* only fills the cache, see texture_prefetch */
+	gboolean prefetch;
+	/* region of the level, see texture_start_tile_action */
+	guint tile;
+	unsigned x;
+	unsigned y;
 
 	unsigned width;
 	unsigned height;
+	unsigned depth;
 	unsigned stride;
 	unsigned size;
 	enum pipe_format format;
-	void *data;
+
+	/* reply holding the data, owned by the action */
+	struct rbug_header *reply;
+	const void *data;
+
+	/* converted data, RGBA8 if unpack_supported otherwise float RGBA */
+	void *pixels;
+	gint bands;
+
+	/* per TEXTURE_DIRTY tile, dirty is NULL if all of them are */
+	guint64 *hashes;
+	gboolean *dirty;
+	unsigned changed;
+	unsigned tiles;
+};
+
+/* rows [y, y + h) of action to convert on a worker thread */
+struct texture_band
+{
+	struct texture_action_read *action;
+	unsigned y;
+	unsigned h;
+	struct program *p;
 };
 
 static void texture_action_read_clean(struct texture_action_read *action,
@@ -258,10 +735,425 @@ static void texture_action_read_clean(struct texture_action_read *action,
 	if (p->texture.read == action)
 		p->texture.read = NULL;
 
-	g_free(action->data);
+	/* only pending while the view is the same, see texture_drop_tiles */
+	if (action->tile && g_hash_table_lookup(p->texture.tiles_pending,
+	    TEXTURE_TILE_KEY(action->level, action->tile)) == action)
+		g_hash_table_remove(p->texture.tiles_pending,
+		                    TEXTURE_TILE_KEY(action->level, action->tile));
+
+	if (action->reply)
+		rbug_free_header(action->reply);
+	g_free(action->pixels);
+	g_free(action->hashes);
+	g_free(action->dirty);
 	g_free(action);
 }
 
+/* drop tile reads for a view that is gone, those not sent yet are freed */
+static void texture_drop_tiles(struct program *p)
+{
+	struct texture_action_read *action;
+	GHashTableIter iter;
+	gpointer value;
+
+	if (!p->texture.tiles_pending)
+		return;
+
+	g_hash_table_iter_init(&iter, p->texture.tiles_pending);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		action = value;
+		g_hash_table_iter_remove(&iter);
+
+		if (rbug_unqueue(&action->e, action->lane, p))
+			texture_action_read_clean(action, p);
+	}
+}
+
+/*
+ * Formats GL can take as is, anything else is unpacked to RGBA8, see
+ * src/unpack.c, or if that does not know it either converted to float.
+ */
+
+#define TEXTURE_GL_RG            (1 << 0)
+#define TEXTURE_GL_HALF_FLOAT    (1 << 1)
+#define TEXTURE_GL_DEPTH_STENCIL (1 << 2)
+
+struct texture_gl_format
+{
+	enum pipe_format format;
+	GLint internal_format;
+	GLenum gl_format;
+	GLenum type;
+	unsigned needs;
+};
+
+static const struct texture_gl_format texture_gl_formats[] = {
+	{ PIPE_FORMAT_B8G8R8A8_UNORM, GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_B8G8R8X8_UNORM, GL_RGB8, GL_BGRA, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_R8G8B8A8_UNORM, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_R8G8B8X8_UNORM, GL_RGB8, GL_RGBA, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_A8R8G8B8_UNORM, GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, 0 },
+	{ PIPE_FORMAT_X8R8G8B8_UNORM, GL_RGB8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, 0 },
+	{ PIPE_FORMAT_A8B8G8R8_UNORM, GL_RGBA8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, 0 },
+	{ PIPE_FORMAT_X8B8G8R8_UNORM, GL_RGB8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, 0 },
+	{ PIPE_FORMAT_B5G6R5_UNORM, GL_RGB, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, 0 },
+	{ PIPE_FORMAT_B5G5R5A1_UNORM, GL_RGB5_A1, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, 0 },
+	{ PIPE_FORMAT_B4G4R4A4_UNORM, GL_RGBA4, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, 0 },
+	{ PIPE_FORMAT_L8_UNORM, GL_LUMINANCE8, GL_LUMINANCE, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_A8_UNORM, GL_ALPHA8, GL_ALPHA, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_I8_UNORM, GL_INTENSITY8, GL_LUMINANCE, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_L8A8_UNORM, GL_LUMINANCE8_ALPHA8, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_R8_UNORM, GL_RGB8, GL_RED, GL_UNSIGNED_BYTE, 0 },
+	{ PIPE_FORMAT_R8G8_UNORM, GL_RGB8, GL_RG, GL_UNSIGNED_BYTE, TEXTURE_GL_RG },
+	{ PIPE_FORMAT_R16G16B16A16_FLOAT, GL_RGBA, GL_RGBA, GL_HALF_FLOAT_ARB, TEXTURE_GL_HALF_FLOAT },
+	{ PIPE_FORMAT_R32G32B32A32_FLOAT, GL_RGBA, GL_RGBA, GL_FLOAT, 0 },
+	{ PIPE_FORMAT_Z16_UNORM, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, 0 },
+	{ PIPE_FORMAT_Z32_UNORM, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0 },
+	/* depth in the top 24 bits, the low 8 only add noise below a step */
+	{ PIPE_FORMAT_X8Z24_UNORM, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0 },
+	{ PIPE_FORMAT_S8_UINT_Z24_UNORM, GL_DEPTH24_STENCIL8_EXT, GL_DEPTH_STENCIL_EXT,
+	  GL_UNSIGNED_INT_24_8_EXT, TEXTURE_GL_DEPTH_STENCIL },
+};
+
+/**
+ * How to upload format without converting it, NULL if it has to be.
+ * Needs the GL context to be current.
+ */
+static const struct texture_gl_format * texture_gl_format(enum pipe_format format,
+                                                          struct program *p)
+{
+	const struct texture_gl_format *f;
+	unsigned have = 0;
+	unsigned i;
+
+	if (!p->texture.gl_checked) {
+		p->texture.gl_rg = gdk_gl_query_gl_extension("GL_ARB_texture_rg");
+		p->texture.gl_half_float = gdk_gl_query_gl_extension("GL_ARB_half_float_pixel");
+		p->texture.gl_depth_stencil = gdk_gl_query_gl_extension("GL_EXT_packed_depth_stencil");
+		p->texture.gl_pbo = gdk_gl_query_gl_extension("GL_ARB_pixel_buffer_object");
+		p->texture.gl_checked = TRUE;
+	}
+
+	if (p->texture.gl_rg)
+		have |= TEXTURE_GL_RG;
+	if (p->texture.gl_half_float)
+		have |= TEXTURE_GL_HALF_FLOAT;
+	if (p->texture.gl_depth_stencil)
+		have |= TEXTURE_GL_DEPTH_STENCIL;
+
+	for (i = 0; i < sizeof(texture_gl_formats) / sizeof(texture_gl_formats[0]); i++) {
+		f = &texture_gl_formats[i];
+		if (f->format == format)
+			return (f->needs & ~have) ? NULL : f;
+	}
+
+	return NULL;
+}
+
+static guint64 texture_hash_round(guint64 acc, guint64 in)
+{
+	acc += in * TEXTURE_HASH_PRIME2;
+	acc = (acc << 31) | (acc >> 33);
+
+	return acc * TEXTURE_HASH_PRIME1;
+}
+
+/**
+ * Hash rows of bytes each stride apart, in the manner of xxHash64:
+ * four independent lanes over 32 bytes at a time and a final mix.
+ */
+static guint64 texture_hash(const uint8_t *data, unsigned stride,
+                            unsigned bytes, unsigned rows)
+{
+	guint64 a = TEXTURE_HASH_PRIME1 + TEXTURE_HASH_PRIME2;
+	guint64 b = TEXTURE_HASH_PRIME2;
+	guint64 c = 0;
+	guint64 d = -TEXTURE_HASH_PRIME1;
+	const uint8_t *row;
+	guint64 v[4];
+	guint64 h;
+	unsigned x, y;
+
+	for (y = 0; y < rows; y++) {
+		row = data + (size_t)stride * y;
+
+		for (x = 0; x + 32 <= bytes; x += 32) {
+			memcpy(v, row + x, 32);
+			a = texture_hash_round(a, v[0]);
+			b = texture_hash_round(b, v[1]);
+			c = texture_hash_round(c, v[2]);
+			d = texture_hash_round(d, v[3]);
+		}
+
+		for (; x + 8 <= bytes; x += 8) {
+			memcpy(v, row + x, 8);
+			a = texture_hash_round(a, v[0]);
+		}
+
+		for (; x < bytes; x++)
+			b = texture_hash_round(b, row[x]);
+	}
+
+	h = ((a << 1) | (a >> 63)) + ((b << 7) | (b >> 57)) +
+	    ((c << 12) | (c >> 52)) + ((d << 18) | (d >> 46));
+
+	h ^= h >> 33;
+	h *= TEXTURE_HASH_PRIME2;
+	h ^= h >> 29;
+	h *= TEXTURE_HASH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/**
+ * Hash the read data of action per TEXTURE_DIRTY tile and compare it with
+ * what was uploaded last time, if it is still around with the same size
+ * and format, to find the tiles that changed. Not done for compressed
+ * formats, they are always uploaded whole.
+ */
+static void texture_action_read_hash(struct texture_action_read *action,
+                                     struct program *p)
+{
+	const struct util_format_description *desc;
+	struct cache_texture *old;
+	unsigned tx, ty, x, y;
+	unsigned bpp;
+	unsigned i;
+
+	desc = util_format_description(action->format);
+	if (desc->block.width != 1 || desc->block.height != 1)
+		return;
+
+	bpp = desc->block.bits / 8;
+	tx = (action->width + TEXTURE_DIRTY - 1) / TEXTURE_DIRTY;
+	ty = (action->height + TEXTURE_DIRTY - 1) / TEXTURE_DIRTY;
+
+	action->tiles = tx * ty;
+	action->changed = action->tiles;
+	action->hashes = g_malloc(sizeof(*action->hashes) * action->tiles);
+
+	for (y = 0, i = 0; y < ty; y++) {
+		for (x = 0; x < tx; x++, i++) {
+			action->hashes[i] =
+				texture_hash((const uint8_t *)action->data +
+				             (size_t)action->stride * y * TEXTURE_DIRTY +
+				             (size_t)bpp * x * TEXTURE_DIRTY,
+				             action->stride,
+				             bpp * MIN(TEXTURE_DIRTY, action->width - x * TEXTURE_DIRTY),
+				             MIN(TEXTURE_DIRTY, action->height - y * TEXTURE_DIRTY));
+		}
+	}
+
+	old = cache_find(action->id, action->level, action->layer, action->tile, p);
+	if (!old || !old->hashes || old->format != action->format ||
+	    old->width != action->width || old->height != action->height)
+		return;
+
+	action->dirty = g_malloc(sizeof(*action->dirty) * action->tiles);
+	action->changed = 0;
+
+	for (i = 0; i < action->tiles; i++) {
+		action->dirty[i] = action->hashes[i] != old->hashes[i];
+		if (action->dirty[i])
+			action->changed++;
+	}
+}
+
+/**
+ * Does any tile in rows [y, y + h) of action need uploading.
+ */
+static gboolean texture_action_read_rows_dirty(struct texture_action_read *action,
+                                               unsigned y, unsigned h)
+{
+	unsigned tx = (action->width + TEXTURE_DIRTY - 1) / TEXTURE_DIRTY;
+	unsigned i;
+
+	if (!action->dirty)
+		return TRUE;
+
+	for (i = (y / TEXTURE_DIRTY) * tx; i < ((y + h + TEXTURE_DIRTY - 1) / TEXTURE_DIRTY) * tx; i++)
+		if (action->dirty[i])
+			return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * Show how many tiles of the viewed texture changed with its last read,
+ * summed over the reads of the tiles on screen when shown in tiles.
+ */
+static void texture_dirty_count(struct texture_action_read *action, struct program *p)
+{
+	guint id = gtk_statusbar_get_context_id(p->main.statusbar, "changes");
+	char text[64];
+
+	if (action->prefetch || !action->tiles)
+		return;
+
+	if (!action->tile) {
+		p->texture.dirty_changed = 0;
+		p->texture.dirty_tiles = 0;
+	}
+
+	p->texture.dirty_changed += action->changed;
+	p->texture.dirty_tiles += action->tiles;
+
+	snprintf(text, sizeof(text), "%u of %u tiles changed",
+	         p->texture.dirty_changed, p->texture.dirty_tiles);
+
+	gtk_statusbar_pop(p->main.statusbar, id);
+	gtk_statusbar_push(p->main.statusbar, id, text);
+}
+
+/**
+ * Convert rows [y, y + h) of action into action->pixels,
+ * called on the worker threads as well.
+ */
+static void texture_action_read_convert_rows(struct texture_action_read *action,
+                                             unsigned y, unsigned h,
+                                             struct program *p)
+{
+	const uint8_t *data = action->data;
+	uint32_t w = action->width;
+	uint32_t src_stride = action->stride;
+	uint32_t dst_stride = 4 * 4 * w;
+	uint32_t step_h;
+	float *rgba;
+	unsigned i;
+
+	if (!texture_action_read_rows_dirty(action, y, h))
+		return;
+
+	if (unpack_supported(action->format)) {
+		unpack_rgba8(action->format, data + src_stride * y, src_stride,
+		             w, h, (uint8_t *)action->pixels + (size_t)w * 4 * y, p);
+		return;
+	}
+
+	step_h = util_format_description(action->format)->block.height;
+	rgba = action->pixels;
+
+	for (i = y; i < y + h; i += step_h) {
+		pipe_tile_raw_to_rgba(action->format, data + src_stride * i,
+		                      w, step_h,
+		                      &rgba[w * 4 * i], dst_stride);
+	}
+}
+
+/**
+ * Convert the rows skipped as unchanged after all, on the main loop.
+ */
+static void texture_action_read_convert_clean(struct texture_action_read *action,
+                                              struct program *p)
+{
+	gboolean *dirty = action->dirty;
+	unsigned y, h;
+
+	if (!dirty || !action->pixels)
+		return;
+
+	for (y = 0; y < action->height; y += TEXTURE_BAND) {
+		h = MIN(TEXTURE_BAND, action->height - y);
+
+		action->dirty = dirty;
+		if (texture_action_read_rows_dirty(action, y, h))
+			continue;
+
+		action->dirty = NULL;
+		texture_action_read_convert_rows(action, y, h, p);
+	}
+
+	action->dirty = dirty;
+}
+
+/**
+ * Fill the bound texture of t with size bytes of data, row_length texels
+ * apart, format is 0 if data is compressed. The storage of t is kept if
+ * it has the same size and format already, then only the TEXTURE_DIRTY
+ * tiles set in dirty are uploaded if it is given. With pixel buffer
+ * objects data is copied into one and returned from right away, GL
+ * uploads from it while the next read comes in. Two are used in turn so
+ * the copy does not wait on the last upload.
+ */
+static void texture_image(struct cache_texture *t, GLint internal_format,
+                          uint32_t w, uint32_t h, GLenum format, GLenum type,
+                          const void *data, size_t size, unsigned row_length,
+                          const gboolean *dirty, struct program *p)
+{
+	gboolean same = t->internal_format == internal_format &&
+	                t->width == w && t->height == h;
+	unsigned tx = (w + TEXTURE_DIRTY - 1) / TEXTURE_DIRTY;
+	const void *pixels = data;
+	gboolean pbo = FALSE;
+	unsigned x, y;
+	void *map;
+
+	if (p->texture.gl_pbo) {
+		if (!p->texture.pbo[0])
+			glGenBuffers(2, p->texture.pbo);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, p->texture.pbo[p->texture.pbo_next]);
+		p->texture.pbo_next ^= 1;
+
+		/* drop the old contents instead of waiting for GL to be done with them */
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		map = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+
+		if (map) {
+			memcpy(map, data, size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			/* offset into the buffer */
+			pixels = NULL;
+			pbo = TRUE;
+		} else {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+
+	if (!format && same) {
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h,
+		                          internal_format, size, pixels);
+	} else if (!format) {
+		glCompressedTexImage2D(GL_TEXTURE_2D, 0, internal_format,
+		                       w, h, 0, size, pixels);
+	} else if (same && dirty) {
+		for (y = 0; y < h; y += TEXTURE_DIRTY) {
+			for (x = 0; x < w; x += TEXTURE_DIRTY) {
+				if (!dirty[(y / TEXTURE_DIRTY) * tx + x / TEXTURE_DIRTY])
+					continue;
+
+				glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+				glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, x, y,
+				                MIN(TEXTURE_DIRTY, w - x),
+				                MIN(TEXTURE_DIRTY, h - y),
+				                format, type, pixels);
+			}
+		}
+
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	} else if (same) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h,
+		                format, type, pixels);
+	} else {
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format,
+		             w, h, 0, format, type, pixels);
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	if (pbo)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	t->internal_format = internal_format;
+}
+
 static void texture_action_read_upload(struct texture_action_read *action,
                                        struct program *p)
 {
@@ -317,10 +1209,16 @@ static void texture_action_read_upload(struct texture_action_read *action,
 		g_assert(0);
 	}
 #endif
+	const struct texture_gl_format *native;
+	struct cache_texture *old;
+	struct cache_texture *t;
 	GLint internal_format;
 	uint32_t w, h;
 	uint32_t src_stride;
-	void *data;
+	unsigned bpp;
+	const uint8_t *data;
+	size_t old_size;
+	size_t size = 0;
 
 	if (!action)
 		return;
@@ -334,29 +1232,49 @@ static void texture_action_read_upload(struct texture_action_read *action,
 	if (!data)
 		return;
 
-	if (!util_format_is_s3tc(action->format)) {
-		uint32_t dst_stride = 4 * 4 * w;
-		uint32_t step_h = util_format_description(action->format)->block.height;
-		float *rgba = g_malloc(dst_stride * h);
-		GLint format, type;
-		unsigned i;
+	old = cache_find(action->id, action->level, action->layer, action->tile, p);
+	old_size = old ? old->size : 0;
 
+	t = cache_add(action->id, action->level, action->layer, action->tile, p);
 
-		for (i = 0; i < h; i += step_h) {
-			pipe_tile_raw_to_rgba(action->format, data + src_stride * i,
-			                      w, step_h,
-			                      &rgba[w * 4 * i], dst_stride);
-		}
+	/* what the hashes were compared against is gone, upload it all */
+	if (action->dirty && (t != old || t->format != action->format ||
+	                      t->width != w || t->height != h)) {
+		texture_action_read_convert_clean(action, p);
+		g_free(action->dirty);
+		action->dirty = NULL;
+		action->changed = action->tiles;
+	}
 
+	native = texture_gl_format(action->format, p);
+	bpp = util_format_get_blocksize(action->format);
+
+	if (action->dirty && !action->changed) {
+		/* same as what is there, only account for it again */
+		size = old_size;
+	} else if (native && bpp && !(src_stride % bpp)) {
+		texture_image(t, native->internal_format, w, h,
+		              native->gl_format, native->type,
+		              data, (size_t)src_stride * h, src_stride / bpp,
+		              action->dirty, p);
+
+		size = (size_t)w * h * bpp;
+	} else if (action->pixels && unpack_supported(action->format)) {
+		texture_image(t, GL_RGBA8, w, h,
+		              GL_RGBA, GL_UNSIGNED_BYTE,
+		              action->pixels, (size_t)w * h * 4, w,
+		              action->dirty, p);
+
+		size = (size_t)w * h * 4;
+	} else if (action->pixels) {
 		internal_format = 4;
-		format = GL_RGBA;
-		type = GL_FLOAT;
 
-		glTexImage2D(GL_TEXTURE_2D, 0, internal_format,
-		             w, h, 0,
-		             format, type, rgba);
+		texture_image(t, internal_format, w, h,
+		              GL_RGBA, GL_FLOAT,
+		              action->pixels, (size_t)w * h * 4 * sizeof(float), w,
+		              action->dirty, p);
 
-		g_free(rgba);
+		size = (size_t)w * h * 4;
 	} else if (util_format_is_s3tc(action->format)) {
 
 		if (action->format == PIPE_FORMAT_DXT1_RGB)
@@ -370,18 +1288,151 @@ static void texture_action_read_upload(struct texture_action_read *action,
 		else
 			g_assert(0);
 
-		glCompressedTexImage2D(GL_TEXTURE_2D, 0, internal_format,
-		                       w, h, 0,
-		                       action->size, data);
+		texture_image(t, internal_format, w, h, 0, 0,
+		              data, action->size, 0, NULL, p);
+
+		size = action->size;
 	}
 
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	p->texture.id = action->id;
-	p->texture.width = action->width;
-	p->texture.height = action->height;
+	t->width = w;
+	t->height = h;
+	t->depth = action->depth;
+	t->levels = MAX(p->texture.info_id == action->id ? p->texture.num_levels : 1, 1);
+	t->format = action->format;
+	cache_sized(t, size, p);
+
+	g_free(t->hashes);
+	t->hashes = action->hashes;
+	action->hashes = NULL;
+
+	texture_dirty_count(action, p);
+
+	if (!action->prefetch && !action->tile)
+		texture_use(t, p);
+}
+
+static void texture_action_read_done(struct texture_action_read *action,
+                                     struct program *p)
+{
+	if (draw_gl_begin(p)) {
+		texture_action_read_upload(action, p);
+		draw_gl_end(p);
+		gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
+
+		if (!action->prefetch && !action->tile)
+			texture_prefetch(action->id, action->level, action->layer, p);
+
+		texture_action_read_clean(action, p);
+	} else {
+		g_assert(0);
+		texture_action_read_clean(action, p);
+	}
+}
+
+static gboolean texture_action_read_converted(gpointer data)
+{
+	struct texture_band *band = data;
+	struct texture_action_read *action = band->action;
+	struct program *p = band->p;
+
+	g_free(band);
+
+	action->pending = FALSE;
+
+	/* stopped while converting */
+	if (!action->running) {
+		texture_action_read_clean(action, p);
+		return FALSE;
+	}
+
+	texture_action_read_done(action, p);
+
+	return FALSE;
+}
+
+static void texture_band_func(gpointer data, gpointer user_data)
+{
+	struct texture_band *band = data;
+	(void)user_data;
+
+	texture_action_read_convert_rows(band->action, band->y, band->h, band->p);
+
+	/* the last band done hands the action back to the main loop */
+	if (g_atomic_int_dec_and_test(&band->action->bands))
+		g_idle_add(texture_action_read_converted, band);
+	else
+		g_free(band);
+}
+
+/**
+ * Start converting the data of action if it can not be uploaded
+ * as it is. Returns TRUE if that happens on the worker threads,
+ * texture_action_read_done is then called once they are done.
+ */
+static gboolean texture_action_read_convert(struct texture_action_read *action,
+                                            struct program *p)
+{
+	const struct texture_gl_format *native;
+	struct texture_band *band;
+	unsigned step_h;
+	unsigned bpp;
+	unsigned rows;
+	unsigned y;
+
+	if (util_format_is_s3tc(action->format))
+		return FALSE;
+
+	/* knowing what GL takes needs the context */
+	if (!draw_gl_begin(p))
+		return FALSE;
+	native = texture_gl_format(action->format, p);
+	draw_gl_end(p);
+
+	bpp = util_format_get_blocksize(action->format);
+	if (native && bpp && !(action->stride % bpp))
+		return FALSE;
+
+	/* nothing to upload */
+	if (action->dirty && !action->changed)
+		return FALSE;
+
+	if (unpack_supported(action->format))
+		action->pixels = g_malloc((size_t)action->width * action->height * 4);
+	else
+		action->pixels = g_malloc((size_t)action->width * action->height * 4 * sizeof(float));
+
+	if (action->height <= TEXTURE_BAND) {
+		texture_action_read_convert_rows(action, 0, action->height, p);
+		return FALSE;
+	}
+
+	if (!p->texture.pool)
+		p->texture.pool = g_thread_pool_new(texture_band_func, NULL,
+		                                    g_get_num_processors(), FALSE, NULL);
+
+	/* bands are whole blocks high */
+	step_h = util_format_description(action->format)->block.height;
+	rows = (TEXTURE_BAND + step_h - 1) / step_h * step_h;
+
+	/* keeps stop from cleaning it until the last band is done */
+	action->pending = TRUE;
+	action->bands = (action->height + rows - 1) / rows;
+
+	for (y = 0; y < action->height; y += rows) {
+		band = g_malloc(sizeof(*band));
+		band->action = action;
+		band->y = y;
+		band->h = MIN(rows, action->height - y);
+		band->p = p;
+
+		g_thread_pool_push(p->texture.pool, band, NULL);
+	}
+
+	return TRUE;
 }
 
 static gboolean texture_action_read_read(struct rbug_event *e,
@@ -417,21 +1468,18 @@ static gboolean texture_action_read_read(struct rbug_event *e,
 			goto error;
 	}
 
+	/* keep the reply and read straight out of it */
+	action->reply = rbug_take_header(p);
 	action->stride = read->stride;
-	action->data = g_malloc(size);
+	action->data = read->data;
 	action->size = size;
-	memcpy(action->data, read->data, size);
 
-	if (draw_gl_begin(p)) {
-		texture_action_read_upload(action, p);
-		draw_gl_end(p);
-		gtk_widget_queue_draw(GTK_WIDGET(p->main.draw));
+	texture_action_read_hash(action, p);
 
-		texture_action_read_clean(action, p);
-	} else {
-		g_assert(0);
-		texture_action_read_clean(action, p);
-	}
+	if (texture_action_read_convert(action, p))
+		return FALSE;
+
+	texture_action_read_done(action, p);
 
 	return FALSE;
 
@@ -441,30 +1489,26 @@ error:
 	return FALSE;
 }
 
-static gboolean texture_action_read_info(struct rbug_event *e,
-                                         struct rbug_header *header,
-                                         struct program *p)
+static int16_t texture_action_read_send_read(struct rbug_event *e,
+                                             uint32_t *serial,
+                                             struct program *p)
 {
-	struct rbug_connection *con = p->rbug.con;
-	struct rbug_proto_texture_info_reply *info;
-	struct texture_action_read *action;
-	uint32_t serial = 0;
-	char info_short_string[128];
-	char info_long_string[128];
-	GdkPixbuf *buf = NULL;
+	struct texture_action_read *action = (struct texture_action_read *)e;
 
-	info = (struct rbug_proto_texture_info_reply *)header;
-	action = (struct texture_action_read *)e;
+	rbug_send_texture_read(p->rbug.con, action->id,
+	                       0, action->level, action->layer,
+	                       action->x, action->y, action->width, action->height,
+	                       serial);
 
-	/* ack pending message */
-	action->pending = FALSE;
+	return RBUG_OP_TEXTURE_READ;
+}
 
-	if (header->opcode != RBUG_OP_TEXTURE_INFO_REPLY) {
-		g_print("warning failed to get info from texture\n");
-		goto error;
-	}
+/* icon shown in the tree for textures of format */
+static GdkPixbuf * texture_format_icon(unsigned format, struct program *p)
+{
+	GdkPixbuf *buf = NULL;
 
-	switch (info->format) {
+	switch (format) {
 	case PIPE_FORMAT_NONE: break;
 	case PIPE_FORMAT_B8G8R8A8_UNORM:	buf = icon_get("bgra", p); break;
 	case PIPE_FORMAT_B8G8R8X8_UNORM:	buf = icon_get("bgrx", p); break;
@@ -610,36 +1654,70 @@ static gboolean texture_action_read_info(struct rbug_event *e,
 	case PIPE_FORMAT_B4G4R4X4_UNORM: break;
 	}
 
-	snprintf(info_short_string, 128, "%s, %ux%ux%u, %s",
-		 tgsi_texture_names[util_pipe_tex_to_tgsi_tex(info->target, info->nr_samples)],
-		 info->width[0], info->height[0], info->depth[0],
-		 util_format_name(info->format)+12);
-	snprintf(info_long_string, 128, "%s (%ux%ux%u) %u", util_format_name(info->format), info->width[0], info->height[0], info->depth[0], info->last_level);
+	return buf;
+}
 
-	gtk_spin_button_set_range(p->main.layer, 0, info->depth[0]-1);
-	gtk_tree_store_set(p->main.treestore, &action->iter,
-	                   COLUMN_PIXBUF, buf,
-	                   COLUMN_INFO_SHORT, info_short_string,
-	                   COLUMN_INFO_LONG, info_long_string, -1);
+static gboolean texture_action_read_info(struct rbug_event *e,
+                                         struct rbug_header *header,
+                                         struct program *p)
+{
+	struct rbug_proto_texture_info_reply *info;
+	struct texture_action_read *action;
+	unsigned i;
+
+	info = (struct rbug_proto_texture_info_reply *)header;
+	action = (struct texture_action_read *)e;
+
+	/* ack pending message */
+	action->pending = FALSE;
+
+	if (header->opcode != RBUG_OP_TEXTURE_INFO_REPLY) {
+		g_print("warning failed to get info from texture\n");
+		goto error;
+	}
+
+	store_set_texture(p->main.store, &action->iter, info,
+	                  thumb_icon(action->id, texture_format_icon(info->format, p), p));
 
 	/* no longer interested in this action */
 	if (!action->running || p->texture.read != action)
 		goto error;
 
-	action->width = info->width[0];
-	action->height = info->height[0];
+	gtk_spin_button_set_range(p->main.layer, 0, info->depth[0]-1);
+
+	/* remember the levels so the ones next to it can be prefetched */
+	p->texture.info_id = action->id;
+	p->texture.format = info->format;
+	p->texture.depth = info->depth[0];
+	p->texture.num_levels = MIN(MIN(info->width_len, info->height_len), 16);
+	for (i = 0; i < p->texture.num_levels; i++) {
+		p->texture.levels[i].width = info->width[i];
+		p->texture.levels[i].height = info->height[i];
+	}
+
+	if (!p->texture.num_levels)
+		goto error;
+
+	gtk_spin_button_set_range(p->main.level, 0, p->texture.num_levels - 1);
+	action->level = MIN(action->level, p->texture.num_levels - 1);
+
+	if (texture_is_tiled(info->width[action->level], info->height[action->level])) {
+		texture_use_tiled(action->level, action->layer, p);
+		goto error;
+	}
+
+	action->width = info->width[action->level];
+	action->height = info->height[action->level];
+	action->depth = info->depth[0];
 	action->format = info->format;
 
-	rbug_send_texture_read(con, action->id,
-	                       0, 0, action->layer,
-	                       0, 0, action->width, action->height,
-	                       &serial);
 	/* new message pending */
 	action->pending = TRUE;
 
 	/* hock up event callback */
 	action->e.func = texture_action_read_read;
-	rbug_add_reply(&action->e, serial, p);
+	action->e.send = texture_action_read_send_read;
+	rbug_queue(&action->e, action->lane, p);
 
 	return FALSE;
 
@@ -668,7 +1746,9 @@ static void texture_start_if_new_read_action(rbug_texture_t t,
 	/* are we currently trying download anything? */
 	if (p->texture.read) {
 		/* ok we are downloading something, but is it the one we want? */
-		if (p->texture.read->id == p->viewed.id) {
+		if (p->texture.read->id == p->viewed.id &&
+		    p->texture.read->level == (unsigned)gtk_spin_button_get_value_as_int(p->main.level) &&
+		    p->texture.read->layer == (unsigned)gtk_spin_button_get_value_as_int(p->main.layer)) {
 			/* don't need to do anything */
 			return;
 		} else {
@@ -676,38 +1756,178 @@ static void texture_start_if_new_read_action(rbug_texture_t t,
 		}
 	}
 
-	p->texture.read = texture_start_read_action(t, iter, p);
+	p->texture.read = texture_start_read_action(t, gtk_spin_button_get_value_as_int(p->main.level),
+	                                            iter, RBUG_LANE_INTERACTIVE, p);
+}
+
+static int16_t texture_action_read_send_info(struct rbug_event *e,
+                                             uint32_t *serial,
+                                             struct program *p)
+{
+	struct texture_action_read *action = (struct texture_action_read *)e;
+
+	rbug_send_texture_info(p->rbug.con, action->id, serial);
+
+	return RBUG_OP_TEXTURE_INFO;
 }
 
 static struct texture_action_read *
-texture_start_read_action(rbug_texture_t t, GtkTreeIter *iter, struct program *p)
+texture_start_read_action(rbug_texture_t t,
+                          unsigned level,
+                          GtkTreeIter *iter,
+                          enum rbug_lane lane,
+                          struct program *p)
 {
-	struct rbug_connection *con = p->rbug.con;
 	struct texture_action_read *action;
-	uint32_t serial = 0;
 
 	action = g_malloc(sizeof(*action));
 	memset(action, 0, sizeof(*action));
 
-	rbug_send_texture_info(con, t, &serial);
-
 	action->e.func = texture_action_read_info;
+	action->e.send = texture_action_read_send_info;
 	action->id = t;
+	action->level = level;
 	action->layer = gtk_spin_button_get_value_as_int(p->main.layer);
 	action->iter = *iter;
+	action->lane = lane;
 	action->pending = TRUE;
 	action->running = TRUE;
 
-	rbug_add_reply(&action->e, serial, p);
+	rbug_queue(&action->e, lane, p);
 
 	return action;
 }
 
+/**
+ * Download a level of the viewed texture into the cache without
+ * showing it, the format and size are known from its last info.
+ */
+static void texture_start_prefetch_action(rbug_texture_t t,
+                                          unsigned level,
+                                          unsigned layer,
+                                          struct program *p)
+{
+	struct texture_action_read *action;
+
+	action = g_malloc(sizeof(*action));
+	memset(action, 0, sizeof(*action));
+
+	action->e.func = texture_action_read_read;
+	action->e.send = texture_action_read_send_read;
+	action->id = t;
+	action->level = level;
+	action->layer = layer;
+	action->lane = RBUG_LANE_BACKGROUND;
+	action->pending = TRUE;
+	action->running = TRUE;
+	action->prefetch = TRUE;
+
+	action->width = p->texture.levels[level].width;
+	action->height = p->texture.levels[level].height;
+	action->depth = p->texture.depth;
+	action->format = p->texture.format;
+
+	rbug_queue(&action->e, RBUG_LANE_BACKGROUND, p);
+}
+
+/**
+ * Read tile tx, ty of level of the texture shown into the cache.
+ */
+static void texture_start_tile_action(unsigned level, unsigned tx, unsigned ty,
+                                      struct program *p)
+{
+	struct texture_action_read *action;
+	guint tile = TEXTURE_TILE_NUM(tx, ty);
+
+	if (g_hash_table_lookup(p->texture.tiles_pending, TEXTURE_TILE_KEY(level, tile)))
+		return;
+
+	action = g_malloc(sizeof(*action));
+	memset(action, 0, sizeof(*action));
+
+	action->e.func = texture_action_read_read;
+	action->e.send = texture_action_read_send_read;
+	action->id = p->texture.id;
+	action->level = level;
+	action->layer = p->texture.layer;
+	action->lane = RBUG_LANE_INTERACTIVE;
+	action->pending = TRUE;
+	action->running = TRUE;
+	action->tile = tile;
+
+	action->x = tx * TEXTURE_TILE;
+	action->y = ty * TEXTURE_TILE;
+	action->width = MIN(TEXTURE_TILE, p->texture.levels[level].width - action->x);
+	action->height = MIN(TEXTURE_TILE, p->texture.levels[level].height - action->y);
+	action->depth = p->texture.depth;
+	action->format = p->texture.format;
+
+	g_hash_table_insert(p->texture.tiles_pending, TEXTURE_TILE_KEY(level, tile), action);
+
+	rbug_queue(&action->e, RBUG_LANE_INTERACTIVE, p);
+}
+
+/* info for a row scrolled into view, see texture_row_visible */
+struct texture_action_row
+{
+	struct rbug_event e;
+
+	rbug_texture_t id;
+	GtkTreeIter iter;
+};
+
+static gboolean texture_action_row_info(struct rbug_event *e,
+                                        struct rbug_header *header,
+                                        struct program *p)
+{
+	struct rbug_proto_texture_info_reply *info;
+	struct texture_action_row *action;
+
+	info = (struct rbug_proto_texture_info_reply *)header;
+	action = (struct texture_action_row *)e;
+
+	/* the row only fills in, nothing about the view changes */
+	if (header->opcode == RBUG_OP_TEXTURE_INFO_REPLY)
+		store_set_texture(p->main.store, &action->iter, info,
+		                  thumb_icon(action->id, texture_format_icon(info->format, p), p));
+
+	g_free(action);
+
+	return FALSE;
+}
+
+static int16_t texture_action_row_send(struct rbug_event *e,
+                                       uint32_t *serial,
+                                       struct program *p)
+{
+	struct texture_action_row *action = (struct texture_action_row *)e;
+
+	rbug_send_texture_info(p->rbug.con, action->id, serial);
+
+	return RBUG_OP_TEXTURE_INFO;
+}
+
+/* shares the request with a thumbnail asking for the same info */
+static void texture_start_row_action(GtkTreeIter *iter, rbug_texture_t id, struct program *p)
+{
+	struct texture_action_row *action;
+
+	action = g_malloc(sizeof(*action));
+	memset(action, 0, sizeof(*action));
+
+	action->e.func = texture_action_row_info;
+	action->e.send = texture_action_row_send;
+	action->id = id;
+	action->iter = *iter;
+
+	rbug_queue_shared(&action->e, RBUG_OP_TEXTURE_INFO, id, RBUG_LANE_BACKGROUND, p);
+}
+
 struct texture_action_list
 {
 	struct rbug_event e;
 
-	GtkTreeStore *store;
+	struct store *store;
 	GtkTreeIter parent;
 };
 
@@ -718,50 +1938,47 @@ static gboolean texture_action_list_list(struct rbug_event *e,
 
 	struct rbug_proto_texture_list_reply *list;
 	struct texture_action_list *action;
-	GtkTreeStore *store;
 	GtkTreeIter *parent;
-	uint32_t i;
+	GHashTable *rows;
 
 	action = (struct texture_action_list *)e;
 	list = (struct rbug_proto_texture_list_reply *)header;
 	parent = &action->parent;
-	store = action->store;
-
-	for (i = 0; i < list->textures_len; i++) {
-		GtkTreeIter iter;
-		gtk_tree_store_insert_with_values(store, &iter, parent, -1,
-		                                  COLUMN_ID, list->textures[i],
-		                                  COLUMN_TYPE, TYPE_TEXTURE,
-		                                  COLUMN_TYPENAME, "texture",
-		                                  COLUMN_INFO_SHORT, "(?x?x?) ?",
-		                                  COLUMN_INFO_LONG, "PIPE_FORMAT_UNKNOWN (?x?x?) ?",
-		                                  -1);
-#if 1
-		texture_start_read_action(list->textures[i], &iter, p);
-#else
-		(void)p;
-#endif
-	}
 
+	/* textures already in the tree are left alone */
+	rows = main_sync_children(parent, TYPE_TEXTURE, list->textures,
+	                          list->textures_len, p);
+	main_add_children(parent, TYPE_TEXTURE, list->textures,
+	                  list->textures_len, rows, p);
+
+	g_hash_table_destroy(rows);
 	g_free(action);
 
 	return FALSE;
 }
 
-static void texture_start_list_action(GtkTreeStore *store, GtkTreeIter *parent, struct program *p)
+static int16_t texture_action_list_send(struct rbug_event *e,
+                                        uint32_t *serial,
+                                        struct program *p)
+{
+	(void)e;
+
+	rbug_send_texture_list(p->rbug.con, serial);
+
+	return RBUG_OP_TEXTURE_LIST;
+}
+
+static void texture_start_list_action(struct store *store, GtkTreeIter *parent, struct program *p)
 {
-	struct rbug_connection *con = p->rbug.con;
 	struct texture_action_list *action;
-	uint32_t serial = 0;
 
 	action = g_malloc(sizeof(*action));
 	memset(action, 0, sizeof(*action));
 
-	rbug_send_texture_list(con, &serial);
-
 	action->e.func = texture_action_list_list;
+	action->e.send = texture_action_list_send;
 	action->store = store;
 	action->parent = *parent;
 
-	rbug_add_reply(&action->e, serial, p);
+	rbug_queue(&action->e, RBUG_LANE_BACKGROUND, p);
 }
@@ -0,0 +1,502 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+/*
+ * Thumbnails of the textures in the tree, shown instead of their format
+ * icon when the Thumbnails button is down.
+ *
+ * Only rows scrolled into view get one. The smallest level that is still
+ * THUMB_SIZE across is read on the background lane and reduced to at
+ * most THUMB_SIZE by averaging blocks of texels on a worker thread. They
+ * are kept per texture so scrolling back to a row is free, and only read
+ * again when a row comes into view after a step, flush or update.
+ */
+
+#include "program.h"
+
+#include "pipe/p_format.h"
+#include "util/u_format.h"
+#undef CLAMP
+#include "util/u_tile.h"
+
+#define THUMB_SIZE 32
+
+struct thumb
+{
+	rbug_texture_t id;
+	GtkTreeRowReference *row;
+
+	/* NULL until the first one is done */
+	GdkPixbuf *pixbuf;
+	/* format icon it replaced in the row */
+	GdkPixbuf *icon;
+
+	guint generation;
+	gboolean pending;
+	/* format that can not be reduced, keeps its icon */
+	gboolean none;
+};
+
+struct thumb_action
+{
+	struct rbug_event e;
+	struct program *p;
+
+	rbug_texture_t id;
+	guint generation;
+
+	enum pipe_format format;
+	unsigned level;
+	unsigned width;
+	unsigned height;
+
+	/* reply holding the data, owned by the action */
+	struct rbug_header *reply;
+	const uint8_t *data;
+	unsigned stride;
+
+	/* reduced RGBA8, handed over to the pixbuf */
+	guchar *pixels;
+	unsigned tw;
+	unsigned th;
+};
+
+static gboolean thumb_action_reduced(gpointer data);
+
+static void thumb_free(gpointer data)
+{
+	struct thumb *t = data;
+
+	if (t->row)
+		gtk_tree_row_reference_free(t->row);
+	if (t->pixbuf)
+		g_object_unref(t->pixbuf);
+	if (t->icon)
+		g_object_unref(t->icon);
+	g_free(t);
+}
+
+static void thumb_pixels_free(guchar *pixels, gpointer data)
+{
+	(void)data;
+
+	g_free(pixels);
+}
+
+static void thumb_action_clean(struct thumb_action *action)
+{
+	if (action->reply)
+		rbug_free_header(action->reply);
+	g_free(action->pixels);
+	g_free(action);
+}
+
+/**
+ * Put pixbuf in the row of t, remembering the icon that was there.
+ */
+static void thumb_show(struct thumb *t, GdkPixbuf *pixbuf, struct program *p)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
+	GtkTreePath *path;
+	GdkPixbuf *icon;
+	GtkTreeIter iter;
+
+	if (!t->row || !gtk_tree_row_reference_valid(t->row))
+		return;
+
+	path = gtk_tree_row_reference_get_path(t->row);
+	gtk_tree_model_get_iter(model, &iter, path);
+	gtk_tree_path_free(path);
+
+	if (!t->icon) {
+		gtk_tree_model_get(model, &iter, COLUMN_PIXBUF, &icon, -1);
+		if (icon != t->pixbuf)
+			t->icon = icon;
+		else if (icon)
+			g_object_unref(icon);
+	}
+
+	store_set_pixbuf(p->main.store, &iter, pixbuf);
+}
+
+
+/*
+ * Worker threads
+ */
+
+
+static void thumb_reduce(gpointer data, gpointer user_data)
+{
+	struct thumb_action *action = data;
+	struct program *p = user_data;
+	unsigned w = action->width;
+	unsigned h = action->height;
+	unsigned tw, th, x, y, i;
+	float *sum, *row;
+	unsigned *count;
+	uint8_t *row8;
+	float *s;
+
+	/* keep the aspect, at least one texel */
+	if (w >= h) {
+		tw = MIN(w, THUMB_SIZE);
+		th = MAX(h * tw / w, 1);
+	} else {
+		th = MIN(h, THUMB_SIZE);
+		tw = MAX(w * th / h, 1);
+	}
+
+	sum = g_malloc0(sizeof(float) * tw * th * 4);
+	count = g_malloc0(sizeof(unsigned) * tw * th);
+	row = g_malloc(sizeof(float) * w * 4);
+	row8 = g_malloc(w * 4);
+
+	for (y = 0; y < h; y++) {
+		const uint8_t *src = action->data + (size_t)action->stride * y;
+
+		if (unpack_rgba8(action->format, src, action->stride, w, 1, row8, p)) {
+			for (x = 0; x < w * 4; x++)
+				row[x] = row8[x] / 255.0f;
+		} else {
+			pipe_tile_raw_to_rgba(action->format, (void *)src, w, 1, row, w * 4 * sizeof(float));
+		}
+
+		/* every texel goes into the output texel covering it */
+		for (x = 0; x < w; x++) {
+			i = (y * th / h) * tw + x * tw / w;
+			s = &sum[i * 4];
+			s[0] += row[x * 4 + 0];
+			s[1] += row[x * 4 + 1];
+			s[2] += row[x * 4 + 2];
+			s[3] += row[x * 4 + 3];
+			count[i]++;
+		}
+	}
+
+	action->pixels = g_malloc(tw * th * 4);
+	action->tw = tw;
+	action->th = th;
+
+	for (i = 0; i < tw * th * 4; i++) {
+		float v = count[i / 4] ? sum[i] / count[i / 4] : 0.0f;
+		action->pixels[i] = (guchar)(MIN(MAX(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+
+	g_free(sum);
+	g_free(count);
+	g_free(row);
+	g_free(row8);
+
+	g_idle_add(thumb_action_reduced, action);
+}
+
+
+/*
+ * Actions
+ */
+
+
+static gboolean thumb_action_reduced(gpointer data)
+{
+	struct thumb_action *action = data;
+	struct program *p = action->p;
+	struct thumb *t;
+
+	/* gone with a refresh or toggling thumbnails off and on */
+	t = p->thumb.hash ? g_hash_table_lookup(p->thumb.hash, &action->id) : NULL;
+	if (!t) {
+		thumb_action_clean(action);
+		return FALSE;
+	}
+
+	if (t->pixbuf)
+		g_object_unref(t->pixbuf);
+
+	t->pixbuf = gdk_pixbuf_new_from_data(action->pixels, GDK_COLORSPACE_RGB, TRUE, 8,
+	                                     action->tw, action->th, action->tw * 4,
+	                                     thumb_pixels_free, NULL);
+	action->pixels = NULL;
+
+	t->generation = action->generation;
+	t->pending = FALSE;
+
+	if (p->thumb.enabled)
+		thumb_show(t, t->pixbuf, p);
+
+	thumb_action_clean(action);
+
+	return FALSE;
+}
+
+static void thumb_action_failed(struct thumb_action *action, gboolean none)
+{
+	struct program *p = action->p;
+	struct thumb *t;
+
+	t = p->thumb.hash ? g_hash_table_lookup(p->thumb.hash, &action->id) : NULL;
+	if (t) {
+		t->pending = FALSE;
+		t->none = none;
+		t->generation = action->generation;
+	}
+
+	thumb_action_clean(action);
+}
+
+static gboolean thumb_action_read(struct rbug_event *e,
+                                  struct rbug_header *header,
+                                  struct program *p)
+{
+	struct thumb_action *action = (struct thumb_action *)e;
+	struct rbug_proto_texture_read_reply *read;
+
+	read = (struct rbug_proto_texture_read_reply *)header;
+
+	if (header->opcode != RBUG_OP_TEXTURE_READ_REPLY ||
+	    read->data_len < (size_t)read->stride * action->height) {
+		thumb_action_failed(action, FALSE);
+		return FALSE;
+	}
+
+	/* keep the reply and reduce straight out of it */
+	action->reply = rbug_take_header(p);
+	action->data = read->data;
+	action->stride = read->stride;
+
+	g_thread_pool_push(p->thumb.pool, action, NULL);
+
+	return FALSE;
+}
+
+static int16_t thumb_action_send_read(struct rbug_event *e,
+                                      uint32_t *serial,
+                                      struct program *p)
+{
+	struct thumb_action *action = (struct thumb_action *)e;
+
+	rbug_send_texture_read(p->rbug.con, action->id,
+	                       0, action->level, 0,
+	                       0, 0, action->width, action->height,
+	                       serial);
+
+	return RBUG_OP_TEXTURE_READ;
+}
+
+static gboolean thumb_action_info(struct rbug_event *e,
+                                  struct rbug_header *header,
+                                  struct program *p)
+{
+	struct thumb_action *action = (struct thumb_action *)e;
+	const struct util_format_description *desc;
+	struct rbug_proto_texture_info_reply *info;
+	unsigned levels;
+	unsigned i;
+
+	info = (struct rbug_proto_texture_info_reply *)header;
+
+	if (header->opcode != RBUG_OP_TEXTURE_INFO_REPLY) {
+		thumb_action_failed(action, FALSE);
+		return FALSE;
+	}
+
+	desc = util_format_description(info->format);
+	levels = MIN(info->width_len, info->height_len);
+
+	/* compressed formats keep their icon */
+	if (!desc || desc->block.width != 1 || desc->block.height != 1 || !levels) {
+		thumb_action_failed(action, TRUE);
+		return FALSE;
+	}
+
+	/* smallest level still THUMB_SIZE across */
+	for (i = levels - 1; i > 0; i--)
+		if (MAX(info->width[i], info->height[i]) >= THUMB_SIZE)
+			break;
+
+	action->format = info->format;
+	action->level = i;
+	action->width = info->width[i];
+	action->height = info->height[i];
+
+	action->e.func = thumb_action_read;
+	action->e.send = thumb_action_send_read;
+	rbug_queue(&action->e, RBUG_LANE_BACKGROUND, p);
+
+	return FALSE;
+}
+
+static int16_t thumb_action_send_info(struct rbug_event *e,
+                                      uint32_t *serial,
+                                      struct program *p)
+{
+	struct thumb_action *action = (struct thumb_action *)e;
+
+	rbug_send_texture_info(p->rbug.con, action->id, serial);
+
+	return RBUG_OP_TEXTURE_INFO;
+}
+
+static void thumb_start_action(struct thumb *t, struct program *p)
+{
+	struct thumb_action *action;
+
+	action = g_malloc(sizeof(*action));
+	memset(action, 0, sizeof(*action));
+
+	action->e.func = thumb_action_info;
+	action->e.send = thumb_action_send_info;
+	action->p = p;
+	action->id = t->id;
+	action->generation = p->cache.generation;
+
+	t->pending = TRUE;
+
+	rbug_queue_shared(&action->e, RBUG_OP_TEXTURE_INFO, t->id, RBUG_LANE_BACKGROUND, p);
+}
+
+
+/*
+ * Private
+ */
+
+
+static void thumb_restore(gpointer key, gpointer value, gpointer data)
+{
+	struct thumb *t = value;
+	struct program *p = data;
+	(void)key;
+
+	if (t->icon)
+		thumb_show(t, t->icon, p);
+}
+
+static void thumb_toggled(GtkToggleToolButton *tool, gpointer data)
+{
+	struct program *p = (struct program *)data;
+
+	p->thumb.enabled = gtk_toggle_tool_button_get_active(tool);
+
+	if (p->thumb.enabled)
+		main_visible_schedule(p);
+	else
+		g_hash_table_foreach(p->thumb.hash, thumb_restore, p);
+}
+
+/*
+ * Exported
+ */
+
+
+void thumb_setup(GtkWidget *tool, struct program *p)
+{
+	p->tool.thumbnails = tool;
+	p->thumb.hash = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, thumb_free);
+	p->thumb.pool = g_thread_pool_new(thumb_reduce, p, 2, FALSE, NULL);
+
+	g_signal_connect(tool, "toggled", G_CALLBACK(thumb_toggled), p);
+}
+
+/**
+ * Waits for reductions running, the rest are dropped.
+ */
+void thumb_fini(struct program *p)
+{
+	if (p->thumb.pool)
+		g_thread_pool_free(p->thumb.pool, TRUE, TRUE);
+	p->thumb.pool = NULL;
+
+	if (p->thumb.hash)
+		g_hash_table_destroy(p->thumb.hash);
+	p->thumb.hash = NULL;
+}
+
+/**
+ * Called for the texture rows on screen, see main_visible_schedule.
+ */
+void thumb_row(GtkTreeIter *iter, rbug_texture_t id, struct program *p)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(p->main.store);
+	GtkTreePath *path;
+	struct thumb *t;
+
+	if (!p->thumb.enabled)
+		return;
+
+	t = g_hash_table_lookup(p->thumb.hash, &id);
+	if (!t) {
+		t = g_malloc(sizeof(*t));
+		memset(t, 0, sizeof(*t));
+		t->id = id;
+		g_hash_table_insert(p->thumb.hash, &t->id, t);
+	}
+
+	/* rows are new after a refresh */
+	if (!t->row || !gtk_tree_row_reference_valid(t->row)) {
+		if (t->row)
+			gtk_tree_row_reference_free(t->row);
+		if (t->icon)
+			g_object_unref(t->icon);
+		t->icon = NULL;
+
+		path = gtk_tree_model_get_path(model, iter);
+		t->row = gtk_tree_row_reference_new(model, path);
+		gtk_tree_path_free(path);
+
+		if (t->pixbuf)
+			thumb_show(t, t->pixbuf, p);
+	}
+
+	if (t->pending || t->generation == p->cache.generation)
+		return;
+	if (t->none && t->pixbuf == NULL && t->generation)
+		return;
+
+	thumb_start_action(t, p);
+}
+
+/**
+ * What to show for texture id instead of its format icon, which is
+ * remembered to go back to when thumbnails are turned off.
+ */
+GdkPixbuf * thumb_icon(rbug_texture_t id, GdkPixbuf *icon, struct program *p)
+{
+	struct thumb *t;
+
+	t = p->thumb.hash ? g_hash_table_lookup(p->thumb.hash, &id) : NULL;
+	if (!t)
+		return icon;
+
+	if (icon && icon != t->icon) {
+		if (t->icon)
+			g_object_unref(t->icon);
+		t->icon = g_object_ref(icon);
+	}
+
+	if (!p->thumb.enabled || !t->pixbuf)
+		return icon;
+
+	return t->pixbuf;
+}
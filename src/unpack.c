@@ -0,0 +1,379 @@
+/*
+ * Copyright 2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.  IN NO EVENT SHALL
+ * VMWARE AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+/*
+ * Unpacking of formats GL can not take as they are, see texture_gl_format,
+ * into RGBA8 rows for upload. Faster than going through float with
+ * pipe_tile_raw_to_rgba which is what every other format still does.
+ *
+ * 32 bit packed formats are described by where each channel ends up in
+ * the output, the same kernel does all of them. Vector versions are
+ * picked at runtime by what the CPU has, see unpack_init.
+ */
+
+#include "program.h"
+
+#include "pipe/p_format.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define UNPACK_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define UNPACK_X86 0
+#endif
+
+enum unpack_level
+{
+	UNPACK_SCALAR = 0,
+	UNPACK_SSE2,
+	UNPACK_AVX2,
+};
+
+/* out channel = ((in >> shift) & mask) * mul, or 0xff if mask is 0 */
+struct unpack_channel
+{
+	unsigned shift;
+	uint32_t mask;
+	uint32_t mul;
+};
+
+struct unpack_format
+{
+	enum pipe_format format;
+	/* bytes per pixel in, 8 is half float RGBA */
+	unsigned bpp;
+	/* R, G, B, A */
+	struct unpack_channel c[4];
+};
+
+#define UNPACK_10(shift) { (shift) + 2, 0xff, 1 }
+#define UNPACK_2(shift)  { (shift), 0x3, 0x55 }
+#define UNPACK_8(shift)  { (shift), 0xff, 1 }
+#define UNPACK_ONE       { 0, 0, 0 }
+
+static const struct unpack_format unpack_formats[] = {
+	{ PIPE_FORMAT_R10G10B10A2_UNORM, 4,
+	  { UNPACK_10(0), UNPACK_10(10), UNPACK_10(20), UNPACK_2(30) } },
+	{ PIPE_FORMAT_B10G10R10A2_UNORM, 4,
+	  { UNPACK_10(20), UNPACK_10(10), UNPACK_10(0), UNPACK_2(30) } },
+	/* depth as grey from its top 8 bits, stencil is dropped */
+	{ PIPE_FORMAT_Z24_UNORM_S8_UINT, 4,
+	  { UNPACK_8(16), UNPACK_8(16), UNPACK_8(16), UNPACK_ONE } },
+	{ PIPE_FORMAT_Z24X8_UNORM, 4,
+	  { UNPACK_8(16), UNPACK_8(16), UNPACK_8(16), UNPACK_ONE } },
+	{ PIPE_FORMAT_S8_UINT_Z24_UNORM, 4,
+	  { UNPACK_8(24), UNPACK_8(24), UNPACK_8(24), UNPACK_ONE } },
+	{ PIPE_FORMAT_X8Z24_UNORM, 4,
+	  { UNPACK_8(24), UNPACK_8(24), UNPACK_8(24), UNPACK_ONE } },
+	{ PIPE_FORMAT_R16G16B16A16_FLOAT, 8,
+	  { UNPACK_ONE, UNPACK_ONE, UNPACK_ONE, UNPACK_ONE } },
+};
+
+static const struct unpack_format * unpack_find(unsigned format)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(unpack_formats) / sizeof(unpack_formats[0]); i++)
+		if (unpack_formats[i].format == format)
+			return &unpack_formats[i];
+
+	return NULL;
+}
+
+
+/*
+ * Scalar
+ */
+
+
+static uint32_t unpack_pixel32(const struct unpack_format *f, uint32_t v)
+{
+	uint32_t out = 0;
+	uint32_t c;
+	unsigned i;
+
+	for (i = 0; i < 4; i++) {
+		if (f->c[i].mask)
+			c = ((v >> f->c[i].shift) & f->c[i].mask) * f->c[i].mul;
+		else
+			c = 0xff;
+		out |= c << (i * 8);
+	}
+
+	return out;
+}
+
+static void unpack_row32_scalar(const struct unpack_format *f,
+                                const uint8_t *src, uint8_t *dst, unsigned width)
+{
+	uint32_t v;
+	unsigned x;
+
+	for (x = 0; x < width; x++) {
+		memcpy(&v, src + x * 4, 4);
+		v = unpack_pixel32(f, v);
+		memcpy(dst + x * 4, &v, 4);
+	}
+}
+
+static float unpack_half(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f;
+	uint32_t man = h & 0x3ff;
+	uint32_t bits;
+	float f;
+
+	if (exp == 0x1f) {
+		bits = sign | 0x7f800000 | (man << 13);
+	} else if (exp) {
+		bits = sign | ((exp + 112) << 23) | (man << 13);
+	} else {
+		/* zero or denormal */
+		f = man / 16777216.0f;
+		return sign ? -f : f;
+	}
+
+	memcpy(&f, &bits, 4);
+	return f;
+}
+
+static uint8_t unpack_unorm8(float f)
+{
+	/* also catches NaN */
+	if (!(f > 0.0f))
+		return 0;
+	if (f >= 1.0f)
+		return 0xff;
+
+	return (uint8_t)(f * 255.0f + 0.5f);
+}
+
+static void unpack_row_half_scalar(const uint8_t *src, uint8_t *dst, unsigned width)
+{
+	uint16_t h;
+	unsigned i;
+
+	for (i = 0; i < width * 4; i++) {
+		memcpy(&h, src + i * 2, 2);
+		dst[i] = unpack_unorm8(unpack_half(h));
+	}
+}
+
+
+/*
+ * SSE2, AVX2 and F16C
+ */
+
+
+#if UNPACK_X86
+
+__attribute__((target("sse2")))
+static void unpack_row32_sse2(const struct unpack_format *f,
+                              const uint8_t *src, uint8_t *dst, unsigned width)
+{
+	__m128i shift[4], place[4], mask[4], mul[4];
+	__m128i v, c, out;
+	unsigned x, i;
+
+	for (i = 0; i < 4; i++) {
+		shift[i] = _mm_cvtsi32_si128(f->c[i].shift);
+		place[i] = _mm_cvtsi32_si128(i * 8);
+		mask[i] = _mm_set1_epi32(f->c[i].mask);
+		mul[i] = _mm_set1_epi32(f->c[i].mul);
+	}
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		v = _mm_loadu_si128((const __m128i *)(src + x * 4));
+		out = _mm_setzero_si128();
+
+		for (i = 0; i < 4; i++) {
+			if (f->c[i].mask) {
+				c = _mm_and_si128(_mm_srl_epi32(v, shift[i]), mask[i]);
+				/* at most 8 bits either side, 16 bit multiply is enough */
+				c = _mm_mullo_epi16(c, mul[i]);
+			} else {
+				c = _mm_set1_epi32(0xff);
+			}
+			out = _mm_or_si128(out, _mm_sll_epi32(c, place[i]));
+		}
+
+		_mm_storeu_si128((__m128i *)(dst + x * 4), out);
+	}
+
+	unpack_row32_scalar(f, src + x * 4, dst + x * 4, width - x);
+}
+
+__attribute__((target("avx2")))
+static void unpack_row32_avx2(const struct unpack_format *f,
+                              const uint8_t *src, uint8_t *dst, unsigned width)
+{
+	__m128i shift[4], place[4];
+	__m256i mask[4], mul[4];
+	__m256i v, c, out;
+	unsigned x, i;
+
+	for (i = 0; i < 4; i++) {
+		shift[i] = _mm_cvtsi32_si128(f->c[i].shift);
+		place[i] = _mm_cvtsi32_si128(i * 8);
+		mask[i] = _mm256_set1_epi32(f->c[i].mask);
+		mul[i] = _mm256_set1_epi32(f->c[i].mul);
+	}
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+		out = _mm256_setzero_si256();
+
+		for (i = 0; i < 4; i++) {
+			if (f->c[i].mask) {
+				c = _mm256_and_si256(_mm256_srl_epi32(v, shift[i]), mask[i]);
+				c = _mm256_mullo_epi16(c, mul[i]);
+			} else {
+				c = _mm256_set1_epi32(0xff);
+			}
+			out = _mm256_or_si256(out, _mm256_sll_epi32(c, place[i]));
+		}
+
+		_mm256_storeu_si256((__m256i *)(dst + x * 4), out);
+	}
+
+	unpack_row32_scalar(f, src + x * 4, dst + x * 4, width - x);
+}
+
+__attribute__((target("sse2,f16c")))
+static void unpack_row_half_f16c(const uint8_t *src, uint8_t *dst, unsigned width)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	__m128i h, lo, hi;
+	__m128 a, b;
+	unsigned x;
+
+	/* two pixels at a time */
+	for (x = 0; x + 2 <= width; x += 2) {
+		h = _mm_loadu_si128((const __m128i *)(src + x * 8));
+
+		/* max/min order turns NaN into 0 */
+		a = _mm_min_ps(_mm_max_ps(_mm_cvtph_ps(h), zero), one);
+		b = _mm_min_ps(_mm_max_ps(_mm_cvtph_ps(_mm_srli_si128(h, 8)), zero), one);
+
+		lo = _mm_cvtps_epi32(_mm_mul_ps(a, scale));
+		hi = _mm_cvtps_epi32(_mm_mul_ps(b, scale));
+
+		lo = _mm_packs_epi32(lo, hi);
+		lo = _mm_packus_epi16(lo, lo);
+
+		_mm_storel_epi64((__m128i *)(dst + x * 4), lo);
+	}
+
+	unpack_row_half_scalar(src + x * 8, dst + x * 4, width - x);
+}
+
+#endif
+
+
+/*
+ * Exported
+ */
+
+
+/**
+ * Pick the kernels for this CPU.
+ */
+void unpack_init(struct program *p)
+{
+#if UNPACK_X86
+	unsigned a, b, c, d;
+#endif
+
+	p->unpack.level = UNPACK_SCALAR;
+	p->unpack.f16c = FALSE;
+
+#if UNPACK_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		p->unpack.level = UNPACK_AVX2;
+	else if (__builtin_cpu_supports("sse2"))
+		p->unpack.level = UNPACK_SSE2;
+
+	/* older compilers have no __builtin_cpu_supports name for it */
+	if (__get_cpuid(1, &a, &b, &c, &d))
+		p->unpack.f16c = (c & bit_F16C) != 0;
+#endif
+}
+
+/**
+ * Does unpack_rgba8 know format.
+ */
+gboolean unpack_supported(unsigned format)
+{
+	return unpack_find(format) != NULL;
+}
+
+/**
+ * Unpack height rows of width pixels of format into tightly
+ * packed RGBA8 at dst. FALSE if format is not supported.
+ */
+gboolean unpack_rgba8(unsigned format,
+                      const uint8_t *src, unsigned src_stride,
+                      unsigned width, unsigned height,
+                      uint8_t *dst, struct program *p)
+{
+	const struct unpack_format *f = unpack_find(format);
+	unsigned y;
+
+	if (!f)
+		return FALSE;
+
+	for (y = 0; y < height; y++, src += src_stride, dst += width * 4) {
+		if (f->bpp == 8) {
+#if UNPACK_X86
+			if (p->unpack.f16c) {
+				unpack_row_half_f16c(src, dst, width);
+				continue;
+			}
+#endif
+			unpack_row_half_scalar(src, dst, width);
+			continue;
+		}
+
+#if UNPACK_X86
+		if (p->unpack.level == UNPACK_AVX2) {
+			unpack_row32_avx2(f, src, dst, width);
+			continue;
+		} else if (p->unpack.level == UNPACK_SSE2) {
+			unpack_row32_sse2(f, src, dst, width);
+			continue;
+		}
+#endif
+		unpack_row32_scalar(f, src, dst, width);
+	}
+
+	return TRUE;
+}